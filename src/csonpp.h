@@ -2,6 +2,7 @@
 #define CSONPP_CSONPP_H_
 
 #include <assert.h>
+#include <string.h>
 
 #include <stdint.h>
 #include <stddef.h>
@@ -9,37 +10,275 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <new>
 #include <algorithm>
+#include <functional>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <iosfwd>
+
+#include "csonpp_detail.h"
 
 namespace csonpp {
 
-class Value;
+/**
+ * a monotonic allocator: memory is handed out of large blocks by bumping
+ * a pointer and is only given back all at once, by Clear() or when the
+ * arena is destroyed.
+ */
+class Arena {
+ public:
+  static const size_t kDefaultBlockSize = 64 * 1024;
+
+  explicit Arena(size_t block_size = kDefaultBlockSize);
+  ~Arena();
+
+  // alignment is a power of 2 no greater than alignof(max_align_t)
+  void* Allocate(size_t size, size_t alignment = sizeof(void*)) {
+    char* begin = cur_ + ((alignment - reinterpret_cast<uintptr_t>(cur_)) & 
+                          (alignment - 1));
+    if (size > static_cast<size_t>(end_ - begin) || begin > end_)
+      return AllocateSlow(size);
+    cur_ = begin + size;
+    return begin;
+  }
+
+  // free everything, the current block is kept for what comes next
+  void Clear();
+
+ private:
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* AllocateSlow(size_t size);
+
+  size_t block_size_;
+  std::vector<char*> blocks_;
+  char* block_;
+  char* cur_;
+  char* end_;
+};
+
+// Alloc rebound to allocate T
+template<class T, class Alloc>
+using RebindAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+/**
+ * allocate from an arena, or with a copy of an Alloc if there is none.
+ * deallocating from an arena does nothing, and a copy of a container
+ * allocated in an arena is allocated with the Alloc alone.
+ */
+template<class T, class Alloc = std::allocator<char> >
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef std::false_type propagate_on_container_copy_assignment;
+  typedef std::false_type propagate_on_container_move_assignment;
+  typedef std::false_type propagate_on_container_swap;
+
+  ArenaAllocator() : storage_(Alloc(), nullptr) {}
+  explicit ArenaAllocator(Arena* arena) : storage_(Alloc(), arena) {}
+  explicit ArenaAllocator(const Alloc& alloc) : storage_(alloc, nullptr) {}
+  template<class U>
+  ArenaAllocator(const ArenaAllocator<U, Alloc>& other) 
+  : storage_(other.GetAllocator(), other.GetArena()) {}
+
+  T* allocate(size_t n) {
+    if (storage_.arena)
+      return static_cast<T*>(storage_.arena->Allocate(n * sizeof(T), alignof(T)));
+    RebindAlloc<T, Alloc> alloc(GetAllocator());
+    return std::allocator_traits<RebindAlloc<T, Alloc> >::allocate(alloc, n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (storage_.arena)
+      return;
+    RebindAlloc<T, Alloc> alloc(GetAllocator());
+    std::allocator_traits<RebindAlloc<T, Alloc> >::deallocate(alloc, p, n);
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator(std::allocator_traits<Alloc>::
+                          select_on_container_copy_construction(GetAllocator()));
+  }
+
+  Arena* GetArena() const {
+    return storage_.arena;
+  }
+
+  const Alloc& GetAllocator() const {
+    return storage_;
+  }
+
+ private:
+  // Alloc is a base so that it takes no room when it has no state
+  struct Storage : Alloc {
+    Storage(const Alloc& alloc, Arena* arena) : Alloc(alloc), arena(arena) {}
+
+    Arena* arena;
+  };
+
+  Storage storage_;
+};
+
+template<class T, class U, class Alloc>
+bool operator==(const ArenaAllocator<T, Alloc>& left, 
+                const ArenaAllocator<U, Alloc>& right) {
+  return left.GetArena() == right.GetArena() && 
+         left.GetAllocator() == right.GetAllocator();
+}
+
+template<class T, class U, class Alloc>
+bool operator!=(const ArenaAllocator<T, Alloc>& left, 
+                const ArenaAllocator<U, Alloc>& right) {
+  return !(left == right);
+}
+
+// a random seed drawn once per process, the keys of an object are
+// hashed with it so that which keys collide can not be told in advance
+uint64_t GetHashSeed();
 
-class Object {
+/**
+ * Value, Object and Array allocate their strings, members and elements
+ * with an Alloc, rebound to what they allocate. an object or an array
+ * keeps the Alloc it is constructed with, as a string does, and a value
+ * allocates and frees its string, object or array with the Alloc of it.
+ * the nested values are built with the Alloc given to them, as by
+ * ValueBuilder, or else with a default constructed one, and a copy
+ * takes the Alloc of what it copies.
+ * Value, Object and Array are the ones using std::allocator.
+ */
+template<class Alloc>
+class BasicValue;
+
+/**
+ * the members are kept in a vector in the order they are inserted,
+ * so that a parsed document is serialized in its own order.
+ * a key is looked up by comparing it with every key, which is faster
+ * than a tree for the few members most objects have. past
+ * kIndexMinSize members, an open addressing hash table of member indexes
+ * is kept along, so that looking up a key takes a probe or two however
+ * large the object is. the hash is seeded per process, and a key is never
+ * more than kMaxProbes slots away from where it hashes to: past that, as
+ * keys crafted to collide would make it, the object falls back to a tree
+ * of its keys, and a lookup stays logarithmic.
+ * the keys are const through an iterator, as they are in a map, and are
+ * allocated where the members are: a key is looked up and inserted as a
+ * StringType, and copied into the arena of an object allocated in one.
+ * the comparison operators do not depend on the order of the members.
+ */
+template<class Alloc>
+class BasicObject {
  public:
-  typedef std::map<std::string, Value> MapType;
-  typedef MapType::const_iterator ConstIterator;
-  typedef MapType::iterator Iterator;
+  typedef BasicValue<Alloc> ValueType;
+  typedef std::basic_string<char, 
+                            std::char_traits<char>, 
+                            RebindAlloc<char, Alloc> > StringType;
+  typedef std::basic_string<char, 
+                            std::char_traits<char>, 
+                            ArenaAllocator<char, Alloc> > KeyType;
+  typedef std::pair<KeyType, ValueType> MemberType;
+  typedef std::vector<MemberType, ArenaAllocator<MemberType, Alloc> > ContainerType;
+  typedef typename ContainerType::const_iterator ConstIterator;
+
+  // walks the members as the iterator of a map does, the key is const
+  class Iterator {
+   public:
+    typedef std::pair<const KeyType&, ValueType&> reference;
+    struct pointer {
+      const reference* operator->() const {
+        return &member;
+      }
+      reference member;
+    };
+    typedef reference value_type;
+    typedef ptrdiff_t difference_type;
+    typedef std::bidirectional_iterator_tag iterator_category;
+
+    Iterator() = default;
+
+    reference operator*() const {
+      return reference(itr_->first, itr_->second);
+    }
+
+    pointer operator->() const {
+      return pointer{**this};
+    }
+
+    Iterator& operator++() {
+      ++itr_;
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      return Iterator(itr_++);
+    }
+
+    Iterator& operator--() {
+      --itr_;
+      return *this;
+    }
+
+    Iterator operator--(int) {
+      return Iterator(itr_--);
+    }
+
+    bool operator==(const Iterator& other) const {
+      return itr_ == other.itr_;
+    }
+
+    bool operator!=(const Iterator& other) const {
+      return itr_ != other.itr_;
+    }
+
+    operator ConstIterator() const {
+      return itr_;
+    }
+
+   private:
+    friend class BasicObject;
+
+    explicit Iterator(typename ContainerType::iterator itr)
+        : itr_(itr) {}
+
+    typename ContainerType::iterator itr_;
+  };
+
+  // the size past which the keys are hashed
+  static const size_t kIndexMinSize = 16;
+  // the longest run of slots probed for a key
+  static const size_t kMaxProbes = 64;
   
-  friend bool operator==(const Object& left, const Object& right);
-  friend bool operator!=(const Object& left, const Object& right);
-  friend bool operator>(const Object& left, const Object& right);
-  friend bool operator<(const Object& left, const Object& right);
-  friend bool operator<=(const Object& left, const Object& right);
-  friend bool operator>=(const Object& left, const Object& right);
+  template<class A>
+  friend bool operator==(const BasicObject<A>& left, const BasicObject<A>& right);
+  template<class A>
+  friend bool operator!=(const BasicObject<A>& left, const BasicObject<A>& right);
+  template<class A>
+  friend bool operator>(const BasicObject<A>& left, const BasicObject<A>& right);
+  template<class A>
+  friend bool operator<(const BasicObject<A>& left, const BasicObject<A>& right);
+  template<class A>
+  friend bool operator<=(const BasicObject<A>& left, const BasicObject<A>& right);
+  template<class A>
+  friend bool operator>=(const BasicObject<A>& left, const BasicObject<A>& right);
 
  public:
-  Object() = default;
-  Object(const Object& other);
-  Object(Object&& other);
+  BasicObject() = default;
+  // the members are allocated with alloc
+  explicit BasicObject(const Alloc& alloc);
+  // the members are allocated in arena, which must outlive the object
+  explicit BasicObject(Arena* arena);
+  BasicObject(const BasicObject& other);
+  BasicObject(BasicObject&& other);
+
+  BasicObject& operator=(const BasicObject& other);
+  BasicObject& operator=(BasicObject&& other);
 
-  Object& operator=(const Object& other);
-  Object& operator=(Object&& other);
+  ~BasicObject();
   
   // find element matching irKey, or insert with default Value
-  Value& operator[](const std::string& key);
-  // find element matching irKey, or insert with default Value
-  Value& operator[](std::string&& key);
+  ValueType& operator[](const StringType& key);
 
   ConstIterator CBegin() const;
   ConstIterator CEnd() const;
@@ -50,45 +289,103 @@ class Object {
   Iterator Begin();
   Iterator End();
   
-  Iterator Find(const std::string& key);
-  ConstIterator Find(const std::string& key) const;
+  Iterator Find(const StringType& key);
+  ConstIterator Find(const StringType& key) const;
   
   void Clear();
 
   size_t Size() const;
+
+  Alloc GetAllocator() const;
+
+  // the hash of a key, seeded with GetHashSeed()
+  static uint64_t Hash(const char* key, size_t size);
   
  private:
-  MapType value_;
+  typedef std::vector<uint32_t, ArenaAllocator<uint32_t, Alloc> > IndexType;
+
+  // the key of a member in the tree, it points into value_
+  struct KeyRef {
+    const char* data;
+    size_t size;
+  };
+
+  struct KeyLess {
+    bool operator()(const KeyRef& left, const KeyRef& right) const {
+      int cmp = memcmp(left.data, right.data, std::min(left.size, right.size));
+      return cmp < 0 || (cmp == 0 && left.size < right.size);
+    }
+  };
+
+  typedef std::pair<const KeyRef, uint32_t> TreeMemberType;
+  typedef std::map<KeyRef, uint32_t, KeyLess, 
+                   ArenaAllocator<TreeMemberType, Alloc> > TreeType;
+
+  // the index of the member named key, Size() if there is none.
+  // slot is set to the slot of index_ where key would be, or to the
+  // size of index_ if no slot is free within kMaxProbes
+  size_t FindIndex(const char* key, size_t size, size_t* slot = nullptr) const;
+  // index the member just appended, whose key would be in slot.
+  // grown tells that value_ was reallocated, which moves the keys
+  void IndexLast(size_t slot, bool grown);
+  // hash every key into capacity slots, a power of 2, or build the tree
+  // if a key is too far from its slot
+  void BuildIndex(size_t capacity);
+  // put every key in the tree instead of index_
+  void BuildTree();
+  void DeleteTree();
+  // the members in the order of their keys
+  std::vector<const MemberType*> Sort() const;
+
+  ContainerType value_;
+  // empty up to kIndexMinSize members, then 0 for a free slot or
+  // 1 + the index of a member, at most half of the slots are taken
+  IndexType index_;
+  // the index of the keys instead of index_ once probing got too long,
+  // allocated where value_ is
+  TreeType* tree_ = nullptr;
 };
 
-class Array {
-  typedef std::vector<Value> ContainerType;
-  typedef ContainerType::const_iterator ConstIterator;
-  typedef ContainerType::iterator Iterator;
+template<class Alloc>
+class BasicArray {
+  typedef BasicValue<Alloc> ValueType;
+  typedef std::vector<ValueType, ArenaAllocator<ValueType, Alloc> > ContainerType;
+  typedef typename ContainerType::const_iterator ConstIterator;
+  typedef typename ContainerType::iterator Iterator;
   
-  friend bool operator==(const Array& left, const Array& right);
-  friend bool operator!=(const Array& left, const Array& right);
-  friend bool operator>(const Array& left, const Array& right);
-  friend bool operator<(const Array& left, const Array& right);
-  friend bool operator>=(const Array& left, const Array& right);
-  friend bool operator<=(const Array& left, const Array& right);
+  template<class A>
+  friend bool operator==(const BasicArray<A>& left, const BasicArray<A>& right);
+  template<class A>
+  friend bool operator!=(const BasicArray<A>& left, const BasicArray<A>& right);
+  template<class A>
+  friend bool operator>(const BasicArray<A>& left, const BasicArray<A>& right);
+  template<class A>
+  friend bool operator<(const BasicArray<A>& left, const BasicArray<A>& right);
+  template<class A>
+  friend bool operator>=(const BasicArray<A>& left, const BasicArray<A>& right);
+  template<class A>
+  friend bool operator<=(const BasicArray<A>& left, const BasicArray<A>& right);
   
  public:
-  Array() = default;
+  BasicArray() = default;
+  // the elements are allocated with alloc
+  explicit BasicArray(const Alloc& alloc);
+  // the elements are allocated in arena, which must outlive the array
+  explicit BasicArray(Arena* arena);
 
-  Array(const Array& other);
-  Array(Array&& other);
+  BasicArray(const BasicArray& other);
+  BasicArray(BasicArray&& other);
 
-  Array& operator=(const Array& other);
-  Array& operator=(Array&& other);
+  BasicArray& operator=(const BasicArray& other);
+  BasicArray& operator=(BasicArray&& other);
   
   // the element must exist
-  Value& operator[](size_t i);
+  ValueType& operator[](size_t i);
   // the element must exist
-  const Value& operator[](size_t i) const;
+  const ValueType& operator[](size_t i) const;
 
-  void Append(const Value& value);
-  void Append(Value&& value);
+  void Append(const ValueType& value);
+  void Append(ValueType&& value);
 
   ConstIterator CBegin() const;
   ConstIterator CEnd() const;
@@ -100,20 +397,26 @@ class Array {
   Iterator Begin();
   Iterator End();
 
-  Iterator Find(const Value& value);
-  ConstIterator Find(const Value& value) const;
+  Iterator Find(const ValueType& value);
+  ConstIterator Find(const ValueType& value) const;
 
   void Clear();
 
   size_t Size() const;
+
+  Alloc GetAllocator() const;
+
+  // drop the elements past size or append null ones up to size
+  void Resize(size_t size);
   
  private:
   ContainerType value_;
 };
 
-class Value {
+// what does not depend on the allocator, so that all values share a Type
+class ValueBase {
  public:
-  enum class Type {
+  enum class Type : uint8_t {
     kDummy    = 0,  /* invalid type */
     kNull     = 1,  /* e.g. null */
     kBool     = 2,  /* e.g. true or false */
@@ -123,108 +426,134 @@ class Value {
     kObject   = 6,  /* e.g. {"a":true} */
     kArray    = 7,  /* e.g. ["a", "b"] */
   };
+};
+
+class ParserImpl;
+class DocumentBuilder;
+
+template<class Alloc>
+class BasicValue : public ValueBase {
+ public:
+  typedef Alloc AllocatorType;
+  typedef BasicObject<Alloc> ObjectType;
+  typedef BasicArray<Alloc> ArrayType;
+  typedef std::basic_string<char, 
+                            std::char_traits<char>, 
+                            RebindAlloc<char, Alloc> > StringType;
 
-  friend bool operator==(const Value& left, const Value& right);
-  friend bool operator!=(const Value& left, const Value& right);
-  friend bool operator<(const Value& left, const Value& right);
-  friend bool operator>(const Value& left, const Value& right);
-  friend bool operator<=(const Value& left, const Value& right);
-  friend bool operator>=(const Value& left, const Value& right);
-
-  explicit Value(Type type = Type::kDummy);
-  explicit Value(std::nullptr_t null);
-	explicit Value(bool value);
-	explicit Value(int8_t value);
-	explicit Value(uint8_t value);
-	explicit Value(int16_t value);
-	explicit Value(uint16_t value);
-	explicit Value(int32_t value);
-	explicit Value(uint32_t value);
-	explicit Value(int64_t value);
+  template<class A>
+  friend bool operator==(const BasicValue<A>& left, const BasicValue<A>& right);
+  template<class A>
+  friend bool operator!=(const BasicValue<A>& left, const BasicValue<A>& right);
+  template<class A>
+  friend bool operator<(const BasicValue<A>& left, const BasicValue<A>& right);
+  template<class A>
+  friend bool operator>(const BasicValue<A>& left, const BasicValue<A>& right);
+  template<class A>
+  friend bool operator<=(const BasicValue<A>& left, const BasicValue<A>& right);
+  template<class A>
+  friend bool operator>=(const BasicValue<A>& left, const BasicValue<A>& right);
+
+  explicit BasicValue(Type type = Type::kDummy);
+  // an empty string, object or array allocated with alloc
+  BasicValue(Type type, const Alloc& alloc);
+  explicit BasicValue(std::nullptr_t null);
+	explicit BasicValue(bool value);
+	explicit BasicValue(int8_t value);
+	explicit BasicValue(uint8_t value);
+	explicit BasicValue(int16_t value);
+	explicit BasicValue(uint16_t value);
+	explicit BasicValue(int32_t value);
+	explicit BasicValue(uint32_t value);
+	explicit BasicValue(int64_t value);
   // TODO
   // do not support uint64_t
 #if 0
-	explicit Value(uint64_t value);
+	explicit BasicValue(uint64_t value);
 #endif
-	explicit Value(float value);
-	explicit Value(double value);
-	explicit Value(const std::string& value);
-	explicit Value(std::string&& value);
-	explicit Value(const Object& value);
-	explicit Value(Object&& value);
-	explicit Value(const Array& value);
-	explicit Value(Array&& value);
-
-  ~Value() {}
-
-	Value(const Value& value);
-  Value(Value&& value);
-
-	Value& operator=(const Value& value);
-	Value& operator=(Value&& value);
-	Value& operator=(bool value);
-	Value& operator=(int8_t value);
-	Value& operator=(uint8_t value);
-	Value& operator=(int16_t value);
-	Value& operator=(uint16_t value);
-	Value& operator=(int32_t value);
-	Value& operator=(uint32_t value);
-	Value& operator=(int64_t value);
+	explicit BasicValue(float value);
+	explicit BasicValue(double value);
+	explicit BasicValue(const StringType& value);
+	explicit BasicValue(StringType&& value);
+	explicit BasicValue(const ObjectType& value);
+	explicit BasicValue(ObjectType&& value);
+	explicit BasicValue(const ArrayType& value);
+	explicit BasicValue(ArrayType&& value);
+
+  ~BasicValue();
+
+	BasicValue(const BasicValue& value);
+  BasicValue(BasicValue&& value) noexcept;
+
+	BasicValue& operator=(const BasicValue& value);
+	BasicValue& operator=(BasicValue&& value) noexcept;
+	BasicValue& operator=(bool value);
+	BasicValue& operator=(int8_t value);
+	BasicValue& operator=(uint8_t value);
+	BasicValue& operator=(int16_t value);
+	BasicValue& operator=(uint16_t value);
+	BasicValue& operator=(int32_t value);
+	BasicValue& operator=(uint32_t value);
+	BasicValue& operator=(int64_t value);
   // TODO
   // do not support uint64_t
 #if 0
-	Value& operator=(uint64_t value);
+	BasicValue& operator=(uint64_t value);
 #endif
-	Value& operator=(float value);
-	Value& operator=(double value);
-	Value& operator=(const std::string& value);
-	Value& operator=(std::string&& value);
-	Value& operator=(const Object& value);
-	Value& operator=(Object&& value);
-	Value& operator=(const Array& value);
-	Value& operator=(Array&& value);
-
-  void Append(const Value& value);
-  void Append(Value&& value);
-  void Append(const std::string& key, bool value);
-  void Append(std::string&& key, bool value);
-  void Append(const std::string& key, int8_t value);
-  void Append(std::string&& key, int8_t value);
-  void Append(const std::string& key, uint8_t value);
-  void Append(std::string&& key, uint8_t value);
-  void Append(const std::string& key, int16_t value);
-  void Append(std::string&& key, uint16_t value);
-  void Append(const std::string& key, int32_t value);
-  void Append(std::string&& key, int32_t value);
-  void Append(const std::string& key, uint32_t value);
-  void Append(std::string&& key, uint32_t value);
-  void Append(const std::string& key, int64_t value);
-  void Append(std::string&& key, int64_t value);
+	BasicValue& operator=(float value);
+	BasicValue& operator=(double value);
+	BasicValue& operator=(const StringType& value);
+	BasicValue& operator=(StringType&& value);
+	BasicValue& operator=(const ObjectType& value);
+	BasicValue& operator=(ObjectType&& value);
+	BasicValue& operator=(const ArrayType& value);
+	BasicValue& operator=(ArrayType&& value);
+
+  void Append(const BasicValue& value);
+  void Append(BasicValue&& value);
+  void Append(const StringType& key, bool value);
+  void Append(StringType&& key, bool value);
+  void Append(const StringType& key, int8_t value);
+  void Append(StringType&& key, int8_t value);
+  void Append(const StringType& key, uint8_t value);
+  void Append(StringType&& key, uint8_t value);
+  void Append(const StringType& key, int16_t value);
+  void Append(StringType&& key, uint16_t value);
+  void Append(const StringType& key, int32_t value);
+  void Append(StringType&& key, int32_t value);
+  void Append(const StringType& key, uint32_t value);
+  void Append(StringType&& key, uint32_t value);
+  void Append(const StringType& key, int64_t value);
+  void Append(StringType&& key, int64_t value);
   // TODO
   // do not support uint64_t
 #if 0
-  void Append(const std::string& key, uint64_t value);
-  void Append(std::string&& key, uint64_t value);
+  void Append(const StringType& key, uint64_t value);
+  void Append(StringType&& key, uint64_t value);
 #endif
-  void Append(const std::string& key, float value);
-  void Append(std::string&& key, float value);
-  void Append(const std::string& key, double value);
-  void Append(std::string&& key, double value);
-  void Append(const std::string& key, const std::string& value);
-  void Append(std::string&& key, const std::string& value);
-  void Append(const std::string& key, std::string&& value);
-  void Append(std::string&& key, std::string&& value);
-  void Append(const std::string& key, const Object& value);
-  void Append(std::string&& key, const Object& value);
-  void Append(const std::string& key, Object&& value);
-  void Append(std::string&& key, Object&& value);
-  void Append(const std::string& key, const Array& value);
-  void Append(std::string&& key, const Array& value);
-  void Append(const std::string& key, Array&& value);
-  void Append(std::string&& key, Array&& value);
+  void Append(const StringType& key, float value);
+  void Append(StringType&& key, float value);
+  void Append(const StringType& key, double value);
+  void Append(StringType&& key, double value);
+  void Append(const StringType& key, const StringType& value);
+  void Append(StringType&& key, const StringType& value);
+  void Append(const StringType& key, StringType&& value);
+  void Append(StringType&& key, StringType&& value);
+  void Append(const StringType& key, const ObjectType& value);
+  void Append(StringType&& key, const ObjectType& value);
+  void Append(const StringType& key, ObjectType&& value);
+  void Append(StringType&& key, ObjectType&& value);
+  void Append(const StringType& key, const ArrayType& value);
+  void Append(StringType&& key, const ArrayType& value);
+  void Append(const StringType& key, ArrayType&& value);
+  void Append(StringType&& key, ArrayType&& value);
 
 	Type GetType() const;
 
+  // the Alloc of the string, object or array, a default constructed one
+  // for any other value
+  Alloc GetAllocator() const;
+
   size_t Size() const;
 
   void Clear();
@@ -240,54 +569,2405 @@ class Value {
   int64_t AsInteger() const;
   double AsDouble() const;
   bool AsBool() const;
-  std::string AsString() const;
-  Object AsObject() const;
-  Array AsArray() const;
+  StringType AsString() const;
+  ObjectType AsObject() const;
+  ArrayType AsArray() const;
 
   const int64_t& GetInteger() const;
   const double& GetDouble() const;
   const bool& GetBool() const;
-  const std::string& GetString() const;
-  const Object& GetObject() const;
-  const Array& GetArray() const;
+  // a string parsed by Parser::DeserializeInSitu() or into a Document is
+  // borrowed: it is held out of the Value, in the input or in the arena,
+  // and GetString() must not be called on it. GetStringData() and
+  // GetStringSize() read any string without copying it, the data is '\0'
+  // terminated, and AsString() returns a copy
+  const StringType& GetString() const;
+  bool IsBorrowedString() const;
+  const char* GetStringData() const;
+  size_t GetStringSize() const;
+  const ObjectType& GetObject() const;
+  const ArrayType& GetArray() const;
 
-  Value& operator[](size_t i);
-  const Value& operator[](size_t i) const;
-  Value& operator[](const std::string& key);
-  Value& operator[](std::string&& key);
+  BasicValue& operator[](size_t i);
+  const BasicValue& operator[](size_t i) const;
+  BasicValue& operator[](const StringType& key);
+  BasicValue& operator[](StringType&& key);
+  // the member must exist
+  const BasicValue& operator[](const StringType& key) const;
   
  private:
-  Type type_;
+  friend class ParserImpl;
+  friend class DocumentBuilder;
 
+  // allocate a T with alloc, and free it with the same one
+  template<class T, class... Args>
+  static T* New(const Alloc& alloc, Args&&... args);
+  template<class T>
+  static void Delete(const Alloc& alloc, T* p);
+
+  static int CompareStrings(const BasicValue& left, const BasicValue& right);
+
+  typedef std::vector<BasicValue, RebindAlloc<BasicValue, Alloc> > NestedType;
+
+  // free what is held out of line, the type is left as is.
+  // the nested objects and arrays are taken out and freed in a loop,
+  // so that freeing a deep value does not recurse once per level
+  void Release();
+  // move the members or elements that are objects or arrays into nested,
+  // those that do not fit are left in place
+  void TakeNested(NestedType& nested);
+  // free the object or array itself along with what is left in it
+  void FreeContainer();
+  // take the payload of value, which is left kDummy
+  void MoveFrom(BasicValue& value);
+  // refer to a string of the buffer given to Parser::DeserializeInSitu()
+  void SetBorrowedString(const char* str, size_t size);
+  // make this value an empty object or array allocated in arena
+  void ResetInArena(Type type, Arena& arena);
+  // make this value a copy of str allocated in arena,
+  // size fits in borrowed_size_
+  void ResetInArena(const char* str, size_t size, Arena& arena);
+
+  /**
+   * a value takes 16 bytes whatever its type: numbers and booleans are
+   * held inline, strings, objects and arrays out of line, so that the
+   * elements of an array lie next to each other.
+   */
   union {
     bool bool_;
     int64_t integer_;
     double double_;
+    StringType* string_;
+    // set instead of string_ if the string is in the buffer
+    // given to Parser::DeserializeInSitu()
+    const char* borrowed_;
+    ObjectType* object_;
+    ArrayType* array_;
   };
-  std::string string_;
-  Array array_;
-  Object object_;
+  Type type_;
+  bool is_borrowed_;
+  // set if the string, object or array is allocated in an arena,
+  // it is neither destroyed nor freed with the value but with the arena
+  bool in_arena_;
+  uint32_t borrowed_size_;
 };
 
+typedef BasicValue<std::allocator<char> > Value;
+typedef BasicObject<std::allocator<char> > Object;
+typedef BasicArray<std::allocator<char> > Array;
+
+// built once in the library
+extern template class BasicObject<std::allocator<char> >;
+extern template class BasicArray<std::allocator<char> >;
+extern template class BasicValue<std::allocator<char> >;
+
+/**
+ * a value together with the arena its strings, objects and arrays are
+ * allocated in by the parser, along with the keys and the vectors of the
+ * containers: nothing in a document owns memory of its own, so Clear()
+ * and the destructor free the blocks of the arena without visiting the
+ * nodes, at a cost in the number of blocks rather than of nodes.
+ * the values of a document refer to its arena, so the root is read only:
+ * nothing can be moved out of it, a copy is allocated on the heap and
+ * outlives the document.
+ * a string of a document is at most UINT32_MAX bytes long.
+ */
+class Document {
+ public:
+  explicit Document(size_t block_size = Arena::kDefaultBlockSize)
+      : arena_(block_size) {}
+
+  const Value& GetRoot() const {
+    return root_;
+  }
+
+  Arena& GetArena() {
+    return arena_;
+  }
+
+  // drop the root, the arena keeps a block for the next document
+  void Clear() {
+    root_ = Value();
+    arena_.Clear();
+  }
+
+ private:
+  friend class ParserImpl;
+
+  Document(const Document&) = delete;
+  Document& operator=(const Document&) = delete;
+
+  // the root is destroyed first
+  Arena arena_;
+  Value root_;
+};
+
+class Reader;
+class Writer;
+
 class Parser {
  public:
-  static bool Deserialize(const std::string& csonpp_str, Value& value);
+  // the deepest nesting of objects and arrays accepted by default
+  static const size_t kDefaultMaxDepth = 512;
+
+  /**
+   * a parser object keeps its tokenizer, its stack and its key buffer
+   * from one document to the next, so that parsing many small documents
+   * on one thread allocates nothing but the values.
+   * the static functions below use a new one for every document.
+   */
+  explicit Parser(size_t max_depth = kDefaultMaxDepth);
+  ~Parser();
+
+  // the same as Deserialize() and DeserializeInSitu()
+  bool Load(const char* csonpp_str, size_t size, Value& value);
+
+  bool Load(const std::string& csonpp_str, Value& value) {
+    return Load(csonpp_str.data(), csonpp_str.size(), value);
+  }
+
+  bool LoadInSitu(char* csonpp_str, size_t size, Value& value);
+
+  bool Load(const char* csonpp_str, size_t size, Document& document);
+
+  // documents nested deeper than max_depth are rejected. the parser,
+  // Serialize() and the destructor of Value do not recurse, so their stack
+  // usage does not depend on the input, copies and comparisons still do
+  static bool Deserialize(const std::string& csonpp_str, 
+                          Value& value, 
+                          size_t max_depth = kDefaultMaxDepth);
 
   static Value Deserialize(const std::string& csonpp_str) {
     Value value;
     Deserialize(csonpp_str, value);
-    return std::move(value);
+    return value;
+  }
+
+  // parse exactly size bytes starting at csonpp_str without copying them,
+  // the input does not need to be '\0' terminated
+  static bool Deserialize(const char* csonpp_str, 
+                          size_t size, 
+                          Value& value, 
+                          size_t max_depth = kDefaultMaxDepth);
+
+  static Value Deserialize(const char* csonpp_str, size_t size) {
+    Value value;
+    Deserialize(csonpp_str, size, value);
+    return value;
+  }
+
+  // parse into the root of document, which is cleared first:
+  // its strings, objects and arrays are allocated in the document's arena
+  static bool Deserialize(const char* csonpp_str, 
+                          size_t size, 
+                          Document& document, 
+                          size_t max_depth = kDefaultMaxDepth);
+
+  static bool Deserialize(const std::string& csonpp_str, 
+                          Document& document, 
+                          size_t max_depth = kDefaultMaxDepth) {
+    return Deserialize(csonpp_str.data(), csonpp_str.size(), document, max_depth);
   }
 
+  // parse a buffer the caller owns and lets the parser modify:
+  // strings are unescaped in place and string Values refer to the buffer
+  // instead of owning a copy, so the buffer must outlive value
+  static bool DeserializeInSitu(char* csonpp_str, 
+                                size_t size, 
+                                Value& value, 
+                                size_t max_depth = kDefaultMaxDepth);
+
+  // parse a document whose top level is a large array with several
+  // threads: the elements are found by a structural pre-scan, then
+  // batches of them are parsed concurrently into a pre-sized Array.
+  // other documents are parsed as by Deserialize().
+  // 0 threads means one per hardware thread
+  static bool DeserializeParallel(const char* csonpp_str, 
+                                  size_t size, 
+                                  Value& value, 
+                                  size_t threads = 0, 
+                                  size_t max_depth = kDefaultMaxDepth);
+
+  /**
+   * build only the parts of the document selected by JSON Pointers
+   * (RFC 6901), where a "*" segment selects every member or element.
+   * value is the document pruned down to the selected parts: an object keeps
+   * the members leading to one of them, an array such elements in their
+   * order, and value is null if nothing is selected.
+   * everything else is skipped by matching brackets, without being built
+   * nor fully validated.
+   * @return false if the document or a pointer is invalid
+   */
+  static bool DeserializeFields(const char* csonpp_str, 
+                                size_t size, 
+                                const std::vector<std::string>& pointers, 
+                                Value& value, 
+                                size_t max_depth = kDefaultMaxDepth);
+
+  static bool DeserializeFields(const std::string& csonpp_str, 
+                                const std::vector<std::string>& pointers, 
+                                Value& value, 
+                                size_t max_depth = kDefaultMaxDepth) {
+    return DeserializeFields(csonpp_str.data(), csonpp_str.size(), 
+                             pointers, value, max_depth);
+  }
+
+  // parse a whole file through a read-only memory mapping, see MappedFile
+  static bool DeserializeFile(const std::string& path, 
+                              Value& value, 
+                              size_t max_depth = kDefaultMaxDepth);
+
   static void Serialize(const Value& value, std::string& csonpp_str);
 
   static std::string Serialize(const Value& value) {
     std::string csonpp_str;
     Serialize(value, csonpp_str);
-    return std::move(csonpp_str);
+    return csonpp_str;
+  }
+
+  /**
+   * the same for a value using another allocator: it is built by a
+   * ValueBuilder from the events of Parse() and written by a Writer,
+   * Value itself takes a faster path.
+   */
+  template<class Alloc>
+  static bool Deserialize(const char* csonpp_str, 
+                          size_t size, 
+                          BasicValue<Alloc>& value, 
+                          size_t max_depth = kDefaultMaxDepth);
+
+  template<class Alloc>
+  static bool Deserialize(const std::string& csonpp_str, 
+                          BasicValue<Alloc>& value, 
+                          size_t max_depth = kDefaultMaxDepth) {
+    return Deserialize(csonpp_str.data(), csonpp_str.size(), value, max_depth);
+  }
+
+  template<class Alloc>
+  static void Serialize(const BasicValue<Alloc>& value, std::string& csonpp_str);
+
+  template<class Alloc>
+  static std::string Serialize(const BasicValue<Alloc>& value) {
+    std::string csonpp_str;
+    Serialize(value, csonpp_str);
+    return csonpp_str;
+  }
+
+  /**
+   * parse without building any Value, the handler is called for each
+   * part of the document in order:
+   *   bool Null();
+   *   bool Bool(bool value);
+   *   bool Int64(int64_t value);
+   *   bool Double(double value);
+   *   bool String(const std::string& value);
+   *   bool StartObject();
+   *   bool Key(const std::string& key);
+   *   bool EndObject();
+   *   bool StartArray();
+   *   bool EndArray();
+   * the strings are only valid during the call, they are given as a
+   * std::string& the handler may as well move from.
+   * the tokenizer and the grammar are templates in this header, so the
+   * handler is called straight from the parsing loop.
+   * @return false if the document is invalid or a handler returns false
+   */
+  template<class Handler>
+  static bool Parse(const char* csonpp_str, 
+                    size_t size, 
+                    Handler& handler, 
+                    size_t max_depth = kDefaultMaxDepth);
+
+  template<class Handler>
+  static bool Parse(const std::string& csonpp_str, 
+                    Handler& handler, 
+                    size_t max_depth = kDefaultMaxDepth) {
+    return Parse(csonpp_str.data(), csonpp_str.size(), handler, max_depth);
+  }
+
+  // read the document from the stream through a fixed size window
+  template<class Handler>
+  static bool Parse(std::istream& stream, 
+                    Handler& handler, 
+                    size_t max_depth = kDefaultMaxDepth);
+
+  // the handler is called for what is left of the reader's document
+  template<class Handler>
+  static bool Parse(Reader& reader, Handler& handler);
+
+ private:
+  Parser(const Parser&) = delete;
+  Parser& operator=(const Parser&) = delete;
+
+  template<class Alloc>
+  static void Write(const BasicValue<Alloc>& value, Writer& writer);
+
+  std::shared_ptr<ParserImpl> impl_;
+};
+
+class ReaderImpl;
+
+/**
+ * a pull parser: every Next() reads the document up to its next part,
+ * nothing is kept but the nesting of the open objects and arrays.
+ * a reader over a file descriptor or a std::istream reads it through a
+ * window of buffer_size bytes, refilled whenever the next token is not
+ * whole in it, so that any input is read in constant memory.
+ * the window only grows to hold a single token longer than itself.
+ */
+class Reader {
+ public:
+  static const size_t kDefaultBufferSize = 64 * 1024;
+
+  enum class Event {
+    kNull,
+    kBool,
+    kInteger,
+    kDouble,
+    kString,
+    kKey,
+    kStartObject,
+    kEndObject,
+    kStartArray,
+    kEndArray,
+    kEnd,     /* the whole document is read */
+    kError,   /* the document is invalid */
+  };
+
+  // the input is not copied, it must outlive the reader
+  Reader(const char* csonpp_str, 
+         size_t size, 
+         size_t max_depth = Parser::kDefaultMaxDepth);
+
+  // read from the current position of fd up to its end,
+  // the descriptor is not closed
+  explicit Reader(int fd, 
+                  size_t max_depth = Parser::kDefaultMaxDepth, 
+                  size_t buffer_size = kDefaultBufferSize);
+
+  // the stream must outlive the reader
+  explicit Reader(std::istream& stream, 
+                  size_t max_depth = Parser::kDefaultMaxDepth, 
+                  size_t buffer_size = kDefaultBufferSize);
+  ~Reader();
+
+  Event Next();
+
+  // the value of the last kBool, kInteger, kDouble, kString or kKey
+  bool GetBool() const;
+  int64_t GetInteger() const;
+  double GetDouble() const;
+  const std::string& GetString() const;
+
+ private:
+  Reader(const Reader&) = delete;
+  Reader& operator=(const Reader&) = delete;
+
+  std::shared_ptr<ReaderImpl> impl_;
+};
+
+/**
+ * write a compact document part by part. its functions are the ones of a
+ * Parser::Parse() handler, so a writer given to Parse() copies a document
+ * without its whitespaces.
+ * nothing is checked, the parts must make a valid document.
+ */
+class Writer {
+ public:
+  // the document is appended to csonpp_str
+  explicit Writer(std::string& csonpp_str)
+      : csonpp_str_(csonpp_str),
+        separate_(false) {}
+
+  bool Null();
+  bool Bool(bool value);
+  bool Int64(int64_t value);
+  bool Double(double value);
+  // str is '\0' terminated
+  bool String(const char* str, size_t size);
+  bool String(const std::string& str) {
+    return String(str.c_str(), str.size());
+  }
+  bool StartObject();
+  // key is '\0' terminated
+  bool Key(const char* key, size_t size);
+  bool Key(const std::string& key) {
+    return Key(key.c_str(), key.size());
+  }
+  bool EndObject();
+  bool StartArray();
+  bool EndArray();
+
+ private:
+  Writer(const Writer&) = delete;
+  Writer& operator=(const Writer&) = delete;
+
+  // a ',' before a value or a key following another one
+  void Separate() {
+    if (separate_)
+      csonpp_str_.append(1, ',');
+  }
+
+  std::string& csonpp_str_;
+  bool separate_;
+};
+
+/**
+ * a Parser::Parse() handler building the document into a value,
+ * of any BasicValue type.
+ */
+template<class ValueType>
+class ValueBuilder {
+ public:
+  typedef typename ValueType::AllocatorType AllocatorType;
+
+  // value is replaced by the document, whose strings, objects and arrays
+  // are allocated with alloc
+  explicit ValueBuilder(ValueType& value, 
+                        const AllocatorType& alloc = AllocatorType())
+      : value_(value),
+        alloc_(alloc),
+        key_(alloc) {}
+
+  bool Null() {
+    Put(ValueType(nullptr));
+    return true;
+  }
+
+  bool Bool(bool value) {
+    Put(ValueType(value));
+    return true;
+  }
+
+  bool Int64(int64_t value) {
+    Put(ValueType(value));
+    return true;
+  }
+
+  bool Double(double value) {
+    Put(ValueType(value));
+    return true;
+  }
+
+  bool String(const std::string& value) {
+    Put(ValueType(typename ValueType::StringType(value.data(), value.size(), alloc_)));
+    return true;
+  }
+
+  bool StartObject() {
+    stack_.push_back(&Put(ValueType(ValueType::Type::kObject, alloc_)));
+    return true;
+  }
+
+  bool Key(const std::string& key) {
+    key_.assign(key.data(), key.size());
+    return true;
+  }
+
+  bool EndObject() {
+    stack_.pop_back();
+    return true;
+  }
+
+  bool StartArray() {
+    stack_.push_back(&Put(ValueType(ValueType::Type::kArray, alloc_)));
+    return true;
+  }
+
+  bool EndArray() {
+    stack_.pop_back();
+    return true;
+  }
+
+ private:
+  ValueBuilder(const ValueBuilder&) = delete;
+  ValueBuilder& operator=(const ValueBuilder&) = delete;
+
+  // the slot of value is the root, the member named key_ of the innermost
+  // open object or the next element of the innermost open array
+  ValueType& Put(ValueType&& value) {
+    if (stack_.empty()) {
+      value_ = std::move(value);
+      return value_;
+    }
+    ValueType& container = *stack_.back();
+    if (container.IsArray()) {
+      container.Append(std::move(value));
+      return container[container.Size() - 1];
+    }
+    ValueType& member = container[key_];
+    member = std::move(value);
+    return member;
+  }
+
+  ValueType& value_;
+  AllocatorType alloc_;
+  // the objects and arrays being built, the innermost one last
+  std::vector<ValueType*> stack_;
+  typename ValueType::StringType key_;
+};
+
+/**
+ * the documents of a JSON Lines (NDJSON) input, one per line.
+ * the lines are parsed one after another with the same parser,
+ * an invalid line is reported and skipped, blank lines are ignored.
+ */
+class DocumentStream {
+ public:
+  enum class Status {
+    kOk,      /* value holds the document */
+    kError,   /* the line is not a valid document, value is kDummy */
+    kEnd,     /* there is no line left */
+  };
+
+  // the input is not copied, it must outlive the stream
+  DocumentStream(const char* csonpp_str, 
+                 size_t size, 
+                 size_t max_depth = Parser::kDefaultMaxDepth);
+  explicit DocumentStream(const std::string& csonpp_str, 
+                          size_t max_depth = Parser::kDefaultMaxDepth);
+  ~DocumentStream();
+
+  Status Next(Value& value);
+
+  // the offset in the input and the line number, from 1,
+  // of the document read last
+  size_t GetOffset() const;
+  size_t GetLine() const;
+
+ private:
+  DocumentStream(const DocumentStream&) = delete;
+  DocumentStream& operator=(const DocumentStream&) = delete;
+
+  std::shared_ptr<ParserImpl> parser_;
+  const char* begin_;
+  const char* cur_;
+  const char* end_;
+  size_t offset_;
+  size_t line_;
+  size_t next_line_;
+};
+
+class ParallelDocumentStreamImpl;
+
+/**
+ * the documents of a JSON Lines input parsed on several threads:
+ * the input is cut at line ends into chunks, which a work stealing pool
+ * of threads parses while the documents already parsed are read.
+ * at most max_chunks chunks are parsed ahead of the reader.
+ */
+class ParallelDocumentStream {
+ public:
+  struct Options {
+    size_t threads;     /* 0 for one per hardware thread */
+    size_t chunk_size;  /* the bytes of a chunk, up to the next line end */
+    size_t max_chunks;  /* 0 for 4 per thread */
+    bool ordered;       /* false to read the chunks as soon as they are parsed */
+    size_t max_depth;
+
+    Options()
+        : threads(0),
+          chunk_size(1 << 20),
+          max_chunks(0),
+          ordered(true),
+          max_depth(Parser::kDefaultMaxDepth) {}
+  };
+
+  // status, offset of the document in the input, document
+  typedef std::function<void(DocumentStream::Status, size_t, Value&)> Callback;
+
+  // the input is not copied, it must outlive the stream
+  ParallelDocumentStream(const char* csonpp_str, 
+                         size_t size, 
+                         const Options& options = Options());
+  explicit ParallelDocumentStream(const std::string& csonpp_str, 
+                                  const Options& options = Options());
+  // the chunks not parsed yet are dropped
+  ~ParallelDocumentStream();
+
+  // the documents of a chunk come in the input order, the chunks too
+  // unless options.ordered is false
+  DocumentStream::Status Next(Value& value);
+
+  // the offset in the input of the document read last
+  size_t GetOffset() const;
+
+  // call callback with every document left, from the calling thread
+  void ForEach(const Callback& callback);
+
+ private:
+  ParallelDocumentStream(const ParallelDocumentStream&) = delete;
+  ParallelDocumentStream& operator=(const ParallelDocumentStream&) = delete;
+
+  std::shared_ptr<ParallelDocumentStreamImpl> impl_;
+};
+
+class PushParserImpl;
+
+/**
+ * a parser fed with a document in pieces as they arrive,
+ * a piece may end anywhere, even inside a string, an escape or a number.
+ * it runs the grammar of Parser::Parse() with one tokenizer for the whole
+ * document, which resumes the token cut by the end of a piece: a string
+ * keeps what it has decoded, and only the bytes of a cut number, literal
+ * or escape are kept. everything before is already in the Value being built.
+ */
+class PushParser {
+ public:
+  explicit PushParser(size_t max_depth = Parser::kDefaultMaxDepth);
+  ~PushParser();
+
+  // @return false once the input is known to be invalid
+  bool Feed(const char* chunk, size_t size);
+
+  // the whole input is fed, move the document into value
+  // @return false if the input is invalid or incomplete
+  bool Finish(Value& value);
+
+  // start over with a new document
+  void Reset();
+
+ private:
+  PushParser(const PushParser&) = delete;
+  PushParser& operator=(const PushParser&) = delete;
+
+  std::shared_ptr<PushParserImpl> impl_;
+};
+
+template<class Handler>
+bool Parser::Parse(const char* csonpp_str, 
+                   size_t size, 
+                   Handler& handler, 
+                   size_t max_depth) {
+  detail::ParserCore core(max_depth);
+  core.Reset(csonpp_str, size);
+  core.GetTokenizer().UseIndex();
+  detail::ParserCore::Status status = core.Next(handler);
+  while (status == detail::ParserCore::Status::kPart)
+    status = core.Next(handler);
+  return status == detail::ParserCore::Status::kEnd;
+}
+
+template<class Handler>
+bool Parser::Parse(std::istream& stream, Handler& handler, size_t max_depth) {
+  Reader reader(stream, max_depth);
+  return Parse(reader, handler);
+}
+
+template<class Handler>
+bool Parser::Parse(Reader& reader, Handler& handler) {
+  while (true) {
+    bool ok = false;
+    switch (reader.Next()) {
+    case Reader::Event::kNull: ok = handler.Null(); break;
+    case Reader::Event::kBool: ok = handler.Bool(reader.GetBool()); break;
+    case Reader::Event::kInteger: ok = handler.Int64(reader.GetInteger()); break;
+    case Reader::Event::kDouble: ok = handler.Double(reader.GetDouble()); break;
+    case Reader::Event::kString: ok = handler.String(reader.GetString()); break;
+    case Reader::Event::kKey: ok = handler.Key(reader.GetString()); break;
+    case Reader::Event::kStartObject: ok = handler.StartObject(); break;
+    case Reader::Event::kEndObject: ok = handler.EndObject(); break;
+    case Reader::Event::kStartArray: ok = handler.StartArray(); break;
+    case Reader::Event::kEndArray: ok = handler.EndArray(); break;
+    case Reader::Event::kEnd: return true;
+    default: return false;
+    }
+    if (!ok)
+      return false;
+  }
+}
+
+template<class Alloc>
+bool Parser::Deserialize(const char* csonpp_str, 
+                         size_t size, 
+                         BasicValue<Alloc>& value, 
+                         size_t max_depth) {
+  ValueBuilder<BasicValue<Alloc> > builder(value);
+  if (Parse(csonpp_str, size, builder, max_depth))
+    return true;
+  value = BasicValue<Alloc>();
+  return false;
+}
+
+template<class Alloc>
+void Parser::Serialize(const BasicValue<Alloc>& value, std::string& csonpp_str) {
+  csonpp_str.clear();
+  Writer writer(csonpp_str);
+  Write(value, writer);
+}
+
+// the same loop as ParserImpl::SerializeValue(), one frame per open container
+template<class Alloc>
+void Parser::Write(const BasicValue<Alloc>& value, Writer& writer) {
+  typedef BasicValue<Alloc> ValueType;
+  struct Frame {
+    const ValueType* container;
+    size_t next;
+  };
+  std::vector<Frame> frames;
+  const ValueType* cur = &value;
+  while (cur) {
+    switch (cur->GetType()) {
+    case ValueBase::Type::kNull:
+      writer.Null();
+      break;
+    case ValueBase::Type::kBool:
+      writer.Bool(cur->GetBool());
+      break;
+    case ValueBase::Type::kInteger:
+      writer.Int64(cur->GetInteger());
+      break;
+    case ValueBase::Type::kDouble:
+      writer.Double(cur->GetDouble());
+      break;
+    case ValueBase::Type::kString:
+      writer.String(cur->GetStringData(), cur->GetStringSize());
+      break;
+    case ValueBase::Type::kObject:
+      writer.StartObject();
+      frames.push_back(Frame{cur, 0});
+      break;
+    case ValueBase::Type::kArray:
+      writer.StartArray();
+      frames.push_back(Frame{cur, 0});
+      break;
+    default:
+      break;
+    }
+
+    cur = nullptr;
+    while (!cur && !frames.empty()) {
+      Frame& frame = frames.back();
+      if (frame.container->GetType() == ValueBase::Type::kObject) {
+        const auto& object = frame.container->GetObject();
+        if (frame.next < object.Size()) {
+          auto const_itr = object.Begin() + frame.next++;
+          writer.Key(const_itr->first.c_str(), const_itr->first.size());
+          cur = &const_itr->second;
+        } else {
+          writer.EndObject();
+          frames.pop_back();
+        }
+      } else {
+        const auto& array = frame.container->GetArray();
+        if (frame.next < array.Size()) {
+          cur = &array[frame.next++];
+        } else {
+          writer.EndArray();
+          frames.pop_back();
+        }
+      }
+    }
+  }
+}
+
+/**
+ * a whole file mapped in memory, to be given to any of the parsers
+ * without copying it first. the mapping is populated up front and
+ * advised for sequential reading where the system supports it.
+ * a writable mapping is private: the changes made by
+ * Parser::DeserializeInSitu() are copied on write and never reach the file.
+ * where mmap() is not available the file is read into memory instead.
+ */
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  bool Open(const std::string& path, bool writable = false);
+  void Close();
+
+  const char* GetData() const {
+    return data_;
+  }
+
+  // nullptr unless the file is opened writable
+  char* GetMutableData() {
+    return writable_ ? data_ : nullptr;
+  }
+
+  size_t GetSize() const {
+    return size_;
+  }
+
+ private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  char* data_;
+  size_t size_;
+  bool writable_;
+};
+
+/**
+ * a value of a document read on demand: nothing is parsed until it is
+ * asked for, and the siblings of the values asked for are skipped by
+ * matching brackets without being built nor fully validated.
+ * it refers to the input of its OnDemandDocument.
+ */
+class OnDemandValue {
+ public:
+  // a missing value, its type is kDummy
+  OnDemandValue();
+
+  // from the first charactor of the value, numbers are kInteger unless
+  // they have a fraction or an exponent
+  Value::Type GetType() const;
+
+  // the member named key of an object, a missing value if there is none.
+  // the search starts after the member found last and wraps around, so
+  // members read in the document order are found in a single pass
+  OnDemandValue operator[](const std::string& key);
+
+  // the i-th element of an array, a missing value if there is none.
+  // reading the elements in order scans the array once
+  OnDemandValue operator[](size_t i);
+
+  // the number of members or elements, counted by skipping all of them
+  size_t Size() const;
+
+  // all of them return false if the value is missing or of another type
+  bool GetInteger(int64_t& integer) const;
+  bool GetDouble(double& num) const;
+  bool GetBool(bool& boolean) const;
+  bool GetString(std::string& str) const;
+  bool IsNull() const;
+
+  // parse the whole value, with its descendants, into a Value
+  bool ToValue(Value& value) const;
+
+ private:
+  friend class OnDemandDocument;
+
+  OnDemandValue(const char* begin, const char* end);
+
+  // the first charactor of the value and the end of the input
+  const char* begin_;
+  const char* end_;
+  // where the next search of a member or element starts
+  const char* cursor_;
+  size_t cursor_index_;
+};
+
+class OnDemandDocument {
+ public:
+  // the input is not copied, it must outlive the document 
+  // and the values read from it
+  OnDemandDocument(const char* csonpp_str, size_t size);
+  explicit OnDemandDocument(const std::string& csonpp_str);
+
+  OnDemandValue& GetRoot() {
+    return root_;
+  }
+
+  OnDemandValue operator[](const std::string& key) {
+    return root_[key];
   }
+
+  OnDemandValue operator[](size_t i) {
+    return root_[i];
+  }
+
+ private:
+  OnDemandValue root_;
 };
 
+template<class Alloc>
+BasicObject<Alloc>::BasicObject(const Alloc& alloc)
+    : value_(typename ContainerType::allocator_type(alloc)),
+      index_(typename IndexType::allocator_type(alloc)) {
+}
+
+template<class Alloc>
+BasicObject<Alloc>::BasicObject(Arena* arena)
+    : value_(typename ContainerType::allocator_type(arena)),
+      index_(typename IndexType::allocator_type(arena)) {
+}
+
+// the tree points into the members, it is built again for a copy
+template<class Alloc>
+BasicObject<Alloc>::BasicObject(const BasicObject& other)
+    : value_(other.value_),
+      index_(other.index_) {
+  if (other.tree_)
+    BuildTree();
+}
+
+// the members keep their buffer, so the tree still points into it
+template<class Alloc>
+BasicObject<Alloc>::BasicObject(BasicObject&& other) 
+: value_(std::move(other.value_)), 
+  index_(std::move(other.index_)),
+  tree_(other.tree_) {
+  other.tree_ = nullptr;
+}
+
+template<class Alloc>
+BasicObject<Alloc>& BasicObject<Alloc>::operator=(const BasicObject& other) {
+  if (this != &other) {
+    value_ = other.value_;
+    index_ = other.index_;
+    DeleteTree();
+    if (other.tree_)
+      BuildTree();
+  }
+  return *this;
+}
+
+// the members are moved one by one unless both are in the same arena,
+// so the tree is built again
+template<class Alloc>
+BasicObject<Alloc>& BasicObject<Alloc>::operator=(BasicObject&& other) {
+  if (this != &other) {
+    value_ = std::move(other.value_);
+    index_ = std::move(other.index_);
+    DeleteTree();
+    if (other.tree_) {
+      other.DeleteTree();
+      BuildTree();
+    }
+  }
+  return *this;
+}
+
+template<class Alloc>
+BasicObject<Alloc>::~BasicObject() {
+  DeleteTree();
+}
+
+// the key is copied with the allocator of the members, into their arena
+template<class Alloc>
+BasicValue<Alloc>& BasicObject<Alloc>::operator[](const StringType& key) {
+  size_t slot = 0;
+  size_t i = FindIndex(key.data(), key.size(), &slot);
+  if (i == value_.size()) {
+    bool grown = value_.size() == value_.capacity();
+    typename KeyType::allocator_type alloc(value_.get_allocator());
+    value_.emplace_back(std::piecewise_construct, 
+                        std::forward_as_tuple(key.data(), key.size(), alloc), 
+                        std::forward_as_tuple());
+    IndexLast(slot, grown);
+  }
+  return value_[i].second;
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::ConstIterator BasicObject<Alloc>::CBegin() const {
+  return value_.cbegin();
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::ConstIterator BasicObject<Alloc>::CEnd() const {
+  return value_.cend();
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::ConstIterator BasicObject<Alloc>::Begin() const {
+  return value_.begin();
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::ConstIterator BasicObject<Alloc>::End() const {
+  return value_.end();
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::Iterator BasicObject<Alloc>::Begin() {
+  return Iterator(value_.begin());
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::Iterator BasicObject<Alloc>::End() {
+  return Iterator(value_.end());
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::Iterator BasicObject<Alloc>::Find(const StringType& key) {
+  return Iterator(value_.begin() + FindIndex(key.data(), key.size()));
+}
+
+template<class Alloc>
+typename BasicObject<Alloc>::ConstIterator BasicObject<Alloc>::Find(const StringType& key) const {
+  return value_.begin() + FindIndex(key.data(), key.size());
+}
+
+template<class Alloc>
+void BasicObject<Alloc>::Clear() {
+  value_.clear();
+  index_.clear();
+  DeleteTree();
+}
+template<class Alloc>
+size_t BasicObject<Alloc>::Size() const {
+  return value_.size();
+}
+
+template<class Alloc>
+Alloc BasicObject<Alloc>::GetAllocator() const {
+  return value_.get_allocator().GetAllocator();
+}
+
+// 8 bytes are mixed in at a time into the seed, and the result goes
+// through the finalizer of murmur3, whose multipliers are used throughout
+template<class Alloc>
+uint64_t BasicObject<Alloc>::Hash(const char* key, size_t size) {
+  uint64_t hash = GetHashSeed() ^ (size * 0x9E3779B97F4A7C15ULL);
+  uint64_t word = 0;
+  for (; size >= 8; key += 8, size -= 8) {
+    memcpy(&word, key, 8);
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 32;
+  }
+  word = 0;
+  memcpy(&word, key, size);
+  hash = (hash ^ word) * 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  return hash ^ (hash >> 33);
+}
+
+template<class Alloc>
+size_t BasicObject<Alloc>::FindIndex(const char* key, 
+                                     size_t size, 
+                                     size_t* slot) const {
+  size_t count = value_.size();
+  if (tree_) {
+    auto itr = tree_->find(KeyRef{key, size});
+    return itr == tree_->end() ? count : itr->second;
+  }
+  if (index_.empty()) {
+    for (size_t i = 0; i < count; ++i) {
+      const KeyType& member_key = value_[i].first;
+      if (member_key.size() == size && !memcmp(member_key.data(), key, size))
+        return i;
+    }
+    return count;
+  }
+
+  // no key is further than kMaxProbes from where it hashes to
+  size_t mask = index_.size() - 1;
+  size_t i = Hash(key, size) & mask;
+  for (size_t probe = 0; probe < kMaxProbes; ++probe, i = (i + 1) & mask) {
+    uint32_t entry = index_[i];
+    if (!entry) {
+      if (slot)
+        *slot = i;
+      return count;
+    }
+    const KeyType& member_key = value_[entry - 1].first;
+    if (member_key.size() == size && !memcmp(member_key.data(), key, size))
+      return entry - 1;
+  }
+  if (slot)
+    *slot = index_.size();
+  return count;
+}
+
+template<class Alloc>
+void BasicObject<Alloc>::IndexLast(size_t slot, bool grown) {
+  size_t count = value_.size();
+  if (tree_) {
+    if (grown) {
+      BuildTree();
+    } else {
+      const KeyType& key = value_.back().first;
+      tree_->emplace(KeyRef{key.data(), key.size()}, 
+                     static_cast<uint32_t>(count - 1));
+    }
+  } else if (index_.empty()) {
+    if (count > kIndexMinSize)
+      BuildIndex(kIndexMinSize * 4);
+  } else if (count * 2 > index_.size()) {
+    BuildIndex(index_.size() * 2);
+  } else if (slot == index_.size()) {
+    BuildTree();
+  } else {
+    index_[slot] = static_cast<uint32_t>(count);
+  }
+}
+
+template<class Alloc>
+void BasicObject<Alloc>::BuildIndex(size_t capacity) {
+  index_.assign(capacity, 0);
+  size_t mask = capacity - 1;
+  for (size_t i = 0; i < value_.size(); ++i) {
+    const KeyType& key = value_[i].first;
+    size_t slot = Hash(key.data(), key.size()) & mask;
+    for (size_t probe = 0; index_[slot]; ++probe) {
+      if (probe == kMaxProbes)
+        return BuildTree();
+      slot = (slot + 1) & mask;
+    }
+    index_[slot] = static_cast<uint32_t>(i + 1);
+  }
+}
+
+template<class Alloc>
+void BasicObject<Alloc>::BuildTree() {
+  index_.clear();
+  if (tree_) {
+    tree_->clear();
+  } else {
+    ArenaAllocator<TreeType, Alloc> alloc(value_.get_allocator());
+    TreeType* tree = alloc.allocate(1);
+    tree_ = new (tree) TreeType(KeyLess(), 
+                                 typename TreeType::allocator_type(alloc));
+  }
+  for (size_t i = 0; i < value_.size(); ++i) {
+    const KeyType& key = value_[i].first;
+    tree_->emplace(KeyRef{key.data(), key.size()}, static_cast<uint32_t>(i));
+  }
+}
+
+template<class Alloc>
+void BasicObject<Alloc>::DeleteTree() {
+  if (!tree_)
+    return;
+  ArenaAllocator<TreeType, Alloc> alloc(tree_->get_allocator());
+  tree_->~TreeType();
+  alloc.deallocate(tree_, 1);
+  tree_ = nullptr;
+}
+
+template<class Alloc>
+std::vector<const typename BasicObject<Alloc>::MemberType*> 
+BasicObject<Alloc>::Sort() const {
+  std::vector<const MemberType*> members;
+  members.reserve(value_.size());
+  for (size_t i = 0; i < value_.size(); ++i)
+    members.push_back(&value_[i]);
+  std::sort(members.begin(), members.end(), 
+            [] (const MemberType* left, const MemberType* right) {
+              return left->first < right->first;
+            });
+  return members;
+}
+
+template<class Alloc>
+BasicArray<Alloc>::BasicArray(const Alloc& alloc) 
+: value_(typename ContainerType::allocator_type(alloc)) {
+}
+
+template<class Alloc>
+BasicArray<Alloc>::BasicArray(Arena* arena) 
+: value_(typename ContainerType::allocator_type(arena)) {
+}
+
+template<class Alloc>
+BasicArray<Alloc>::BasicArray(const BasicArray& array) 
+: value_(array.value_) {
+}
+
+template<class Alloc>
+BasicArray<Alloc>::BasicArray(BasicArray&& array) 
+: value_(std::move(array.value_)) {
+}
+
+template<class Alloc>
+BasicArray<Alloc>& BasicArray<Alloc>::operator=(const BasicArray& array) {
+  if (this != &array)
+    value_ = array.value_;
+  return *this;
+}
+
+template<class Alloc>
+BasicArray<Alloc>& BasicArray<Alloc>::operator=(BasicArray&& array) {
+  if (this != &array)
+    value_ = std::move(array.value_);
+  return *this;
+}
+
+// the element must exist
+template<class Alloc>
+BasicValue<Alloc>& BasicArray<Alloc>::operator[](size_t i) {
+  assert(i < value_.size());
+  return value_[i];
+}
+
+// the element must exist
+template<class Alloc>
+const BasicValue<Alloc>& BasicArray<Alloc>::operator[](size_t i) const {
+  assert(i < value_.size());
+  return value_[i];
+}
+
+template<class Alloc>
+void BasicArray<Alloc>::Append(const ValueType& value) {
+  value_.push_back(value);
+}
+
+template<class Alloc>
+void BasicArray<Alloc>::Append(ValueType&& value) {
+  value_.push_back(std::move(value));
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::ConstIterator BasicArray<Alloc>::CBegin() const {
+  return value_.cbegin();
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::ConstIterator BasicArray<Alloc>::CEnd() const {
+  return value_.cend();
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::ConstIterator BasicArray<Alloc>::Begin() const {
+  return value_.begin();
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::ConstIterator BasicArray<Alloc>::End() const {
+  return value_.end();
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::Iterator BasicArray<Alloc>::Begin() {
+  return value_.begin();
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::Iterator BasicArray<Alloc>::End() {
+  return value_.end();
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::Iterator BasicArray<Alloc>::Find(const ValueType& value) {
+  return std::find(Begin(), End(), value);
+}
+
+template<class Alloc>
+typename BasicArray<Alloc>::ConstIterator BasicArray<Alloc>::Find(const ValueType& value) const {
+  return std::find(Begin(), End(), value);
+}
+
+template<class Alloc>
+void BasicArray<Alloc>::Clear() {
+  value_.clear();
+}
+
+template<class Alloc>
+size_t BasicArray<Alloc>::Size() const {
+  return value_.size();
+}
+
+template<class Alloc>
+Alloc BasicArray<Alloc>::GetAllocator() const {
+  return value_.get_allocator().GetAllocator();
+}
+
+template<class Alloc>
+void BasicArray<Alloc>::Resize(size_t size) {
+  value_.resize(size, ValueType(nullptr));
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(Type type)
+    : BasicValue(type, Alloc()) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(Type type, const Alloc& alloc)
+    : integer_(0),
+      type_(type),
+      is_borrowed_(false),
+      in_arena_(false),
+      borrowed_size_(0) {
+  switch (type_) {
+  case Type::kString:
+    string_ = New<StringType>(alloc, alloc);
+    break;
+  case Type::kObject:
+    object_ = New<ObjectType>(alloc, alloc);
+    break;
+  case Type::kArray:
+    array_ = New<ArrayType>(alloc, alloc);
+    break;
+  default:
+    break;
+  }
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(std::nullptr_t)
+    : integer_(0),
+      type_(Type::kNull),
+      is_borrowed_(false),
+      in_arena_(false),
+      borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(bool value) 
+: bool_(value), 
+  type_(Type::kBool), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(int8_t value) 
+: integer_(static_cast<int64_t>(value)), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(uint8_t value) 
+: integer_(static_cast<int64_t>(value)), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(int16_t value) 
+: integer_(static_cast<int64_t>(value)), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(uint16_t value) 
+: integer_(static_cast<int64_t>(value)), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(int32_t value) 
+: integer_(static_cast<int64_t>(value)), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(uint32_t value) 
+: integer_(static_cast<int64_t>(value)), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(int64_t value) 
+: integer_(value), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+// TODO
+// do not support uint64_t
+#if 0
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(uint64_t value) 
+: integer_(value), 
+  type_(Type::kInteger), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+#endif
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(float value) 
+: double_(static_cast<double>(value)), 
+  type_(Type::kDouble), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(double value) 
+: double_(value), 
+  type_(Type::kDouble), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(const StringType& value) 
+: string_(New<StringType>(Alloc(value.get_allocator()), value)), 
+  type_(Type::kString), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(StringType&& value) 
+: string_(New<StringType>(Alloc(value.get_allocator()), std::move(value))), 
+  type_(Type::kString), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(const ObjectType& value) 
+: object_(New<ObjectType>(value.GetAllocator(), value)), 
+  type_(Type::kObject), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(ObjectType&& value) 
+: object_(New<ObjectType>(value.GetAllocator(), std::move(value))), 
+  type_(Type::kObject), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(const ArrayType& value) 
+: array_(New<ArrayType>(value.GetAllocator(), value)), 
+  type_(Type::kArray), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(ArrayType&& value) 
+: array_(New<ArrayType>(value.GetAllocator(), std::move(value))), 
+  type_(Type::kArray), 
+  is_borrowed_(false), 
+  in_arena_(false), 
+  borrowed_size_(0) {
+}
+
+template<class Alloc>
+template<class T, class... Args>
+T* BasicValue<Alloc>::New(const Alloc& alloc, Args&&... args) {
+  typedef RebindAlloc<T, Alloc> Allocator;
+  Allocator rebound(alloc);
+  T* p = std::allocator_traits<Allocator>::allocate(rebound, 1);
+  try {
+    ::new (static_cast<void*>(p)) T(std::forward<Args>(args)...);
+  } catch (...) {
+    std::allocator_traits<Allocator>::deallocate(rebound, p, 1);
+    throw;
+  }
+  return p;
+}
+
+template<class Alloc>
+template<class T>
+void BasicValue<Alloc>::Delete(const Alloc& alloc, T* p) {
+  typedef RebindAlloc<T, Alloc> Allocator;
+  Allocator rebound(alloc);
+  p->~T();
+  std::allocator_traits<Allocator>::deallocate(rebound, p, 1);
+}
+
+template<class Alloc>
+BasicValue<Alloc>::~BasicValue() {
+  Release();
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(const BasicValue& value) 
+: integer_(value.integer_), 
+  type_(value.type_), 
+  is_borrowed_(value.is_borrowed_), 
+  in_arena_(false), 
+  borrowed_size_(value.borrowed_size_) {
+  typedef std::allocator_traits<Alloc> Traits;
+  switch(type_) {
+  case Type::kString:
+    // only a string parsed in situ is still borrowed by the copy
+    if (!is_borrowed_ || value.in_arena_) {
+      Alloc alloc = Traits::select_on_container_copy_construction(value.GetAllocator());
+      string_ = New<StringType>(alloc, value.GetStringData(), value.GetStringSize(), alloc);
+      is_borrowed_ = false;
+    }
+    break;
+  case Type::kObject:
+    object_ = New<ObjectType>(
+        Traits::select_on_container_copy_construction(value.GetAllocator()), 
+        *value.object_);
+    break;
+  case Type::kArray:
+    array_ = New<ArrayType>(
+        Traits::select_on_container_copy_construction(value.GetAllocator()), 
+        *value.array_);
+    break;
+  default:
+    break;
+  }
+}
+
+template<class Alloc>
+BasicValue<Alloc>::BasicValue(BasicValue&& value) noexcept {
+  MoveFrom(value);
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(const BasicValue& value) {
+  if (&value != this)
+    *this = BasicValue(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(BasicValue&& value) noexcept {
+  if (&value != this) {
+    // value may be a descendant of this one,
+    // the old payload is freed only once value is taken
+    BasicValue old(std::move(*this));
+    MoveFrom(value);
+  }
+
+  return *this;
+}
+
+// an object or array allocated in an arena holds nothing but what is
+// allocated there as well, so it is left to the arena without a visit
+template<class Alloc>
+void BasicValue<Alloc>::Release() {
+  switch(type_) {
+  case Type::kString:
+    if (!is_borrowed_)
+      Delete(GetAllocator(), string_);
+    return;
+  case Type::kObject:
+  case Type::kArray:
+    if (in_arena_)
+      return;
+    break;
+  default:
+    return;
+  }
+
+  typename NestedType::allocator_type alloc(GetAllocator());
+  NestedType nested(alloc);
+  TakeNested(nested);
+  FreeContainer();
+  while (!nested.empty()) {
+    BasicValue value(std::move(nested.back()));
+    nested.pop_back();
+    value.TakeNested(nested);
+    value.FreeContainer();
+    value.type_ = Type::kDummy;
+  }
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::TakeNested(NestedType& nested) {
+  // when nested cannot grow, what is left is freed recursively
+  try {
+    if (type_ == Type::kObject) {
+      for (auto itr = object_->Begin(); itr != object_->End(); ++itr) {
+        BasicValue& member = itr->second;
+        if (member.type_ == Type::kObject || member.type_ == Type::kArray)
+          nested.push_back(std::move(member));
+      }
+    } else {
+      for (size_t i = 0; i < array_->Size(); ++i) {
+        BasicValue& element = (*array_)[i];
+        if (element.type_ == Type::kObject || element.type_ == Type::kArray)
+          nested.push_back(std::move(element));
+      }
+    }
+  } catch (...) {
+  }
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::FreeContainer() {
+  if (type_ == Type::kObject) {
+    if (in_arena_)
+      object_->~ObjectType();
+    else
+      Delete(object_->GetAllocator(), object_);
+  } else {
+    if (in_arena_)
+      array_->~ArrayType();
+    else
+      Delete(array_->GetAllocator(), array_);
+  }
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::MoveFrom(BasicValue& value) {
+  integer_ = value.integer_;
+  type_ = value.type_;
+  is_borrowed_ = value.is_borrowed_;
+  in_arena_ = value.in_arena_;
+  borrowed_size_ = value.borrowed_size_;
+  value.type_ = Type::kDummy;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::SetBorrowedString(const char* str, size_t size) {
+  // the size is kept in 32 bits, a longer string is copied
+  if (size > UINT32_MAX) {
+    *this = StringType(str, size);
+    return;
+  }
+  Release();
+  type_ = Type::kString;
+  borrowed_ = str;
+  is_borrowed_ = true;
+  in_arena_ = false;
+  borrowed_size_ = static_cast<uint32_t>(size);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::ResetInArena(Type type, Arena& arena) {
+  assert(type == Type::kObject || type == Type::kArray);
+  Release();
+  type_ = type;
+  is_borrowed_ = false;
+  in_arena_ = true;
+  if (type == Type::kObject)
+    object_ = new (arena.Allocate(sizeof(ObjectType), alignof(ObjectType))) ObjectType(&arena);
+  else
+    array_ = new (arena.Allocate(sizeof(ArrayType), alignof(ArrayType))) ArrayType(&arena);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::ResetInArena(const char* str, size_t size, Arena& arena) {
+  assert(size <= UINT32_MAX);
+  char* copy = static_cast<char*>(arena.Allocate(size + 1, 1));
+  memcpy(copy, str, size);
+  copy[size] = '\0';
+  SetBorrowedString(copy, size);
+  in_arena_ = true;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(bool value) {
+  Release();
+  type_ = Type::kBool;
+  bool_ = value;
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(int8_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = static_cast<int64_t>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(uint8_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = static_cast<int64_t>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(int16_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = static_cast<int64_t>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(uint16_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = static_cast<int64_t>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(int32_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = static_cast<int64_t>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(uint32_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = static_cast<int64_t>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(int64_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = value;
+  return *this;
+}
+
+// TODO
+// do not support uint64_t
+#if 0
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(uint64_t value) {
+  Release();
+  type_ = Type::kInteger;
+  integer_ = value;
+  return *this;
+}
+#endif
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(float value) {
+  Release();
+  type_ = Type::kDouble;
+  double_ = static_cast<double>(value);
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(double value) {
+  Release();
+  type_ = Type::kDouble;
+  double_ = value;
+  return *this;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(const StringType& value) {
+  return *this = BasicValue(value);
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(StringType&& value) {
+  return *this = BasicValue(std::move(value));
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(const ObjectType& value) {
+  return *this = BasicValue(value);
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(ObjectType&& value) {
+  return *this = BasicValue(std::move(value));
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(const ArrayType& value) {
+  return *this = BasicValue(value);
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator=(ArrayType&& value) {
+  return *this = BasicValue(std::move(value));
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const BasicValue& value) {
+  assert(type_ == Type::kArray);
+  array_->Append(value);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(BasicValue&& value) {
+  assert(type_ == Type::kArray);
+  array_->Append(std::move(value));
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, bool value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, bool value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, int8_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, int8_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, uint8_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, uint8_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, int16_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, uint16_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, int32_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, int32_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, uint32_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, uint32_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, int64_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, int64_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+// TODO
+// do not support uint64_t
+#if 0
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, uint64_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, uint64_t value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+#endif
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, float value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, float value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, double value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, double value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, const StringType& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, const StringType& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, StringType&& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = std::move(value);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, StringType&& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = std::move(value);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, const ObjectType& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, const ObjectType& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, ObjectType&& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = std::move(value);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, ObjectType&& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = std::move(value);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, const ArrayType& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, const ArrayType& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = value;
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(const StringType& key, ArrayType&& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[key] = std::move(value);
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Append(StringType&& key, ArrayType&& value) {
+  assert(type_ == Type::kObject);
+  (*object_)[std::move(key)] = std::move(value);
+}
+
+template<class Alloc>
+ValueBase::Type BasicValue<Alloc>::GetType() const {
+  return type_;
+}
+
+template<class Alloc>
+Alloc BasicValue<Alloc>::GetAllocator() const {
+  switch (type_) {
+  case Type::kString:
+    if (is_borrowed_)
+      return Alloc();
+    return Alloc(string_->get_allocator());
+  case Type::kObject:
+    return object_->GetAllocator();
+  case Type::kArray:
+    return array_->GetAllocator();
+  default:
+    return Alloc();
+  }
+}
+
+template<class Alloc>
+size_t BasicValue<Alloc>::Size() const {
+  assert(type_ == Type::kObject || type_ == Type::kArray);
+  return (type_ == Type::kObject) ? object_->Size() : array_->Size();
+}
+
+template<class Alloc>
+void BasicValue<Alloc>::Clear() {
+  switch (type_) {
+  case Type::kArray:
+    array_->Clear();
+    return;
+  case Type::kObject:
+    object_->Clear();
+    return;
+  default:
+    assert(false);
+    return;
+  }
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsNumeric() const {
+  return (type_ == Type::kDouble || type_ == Type::kInteger);
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsIntegral() const {
+  return type_ == Type::kInteger;
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsDouble() const {
+  return type_ == Type::kDouble;
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsBool() const {
+  return type_ == Type::kBool;
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsString() const {
+  return type_ == Type::kString;
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsObject() const {
+  return type_ == Type::kObject;
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsArray() const {
+  return type_ == Type::kArray;
+}
+
+template<class Alloc>
+int64_t BasicValue<Alloc>::AsInteger() const {
+  if (type_ == Type::kInteger) {
+    return integer_;
+  } else if (type_ == Type::kDouble) {
+    return static_cast<int64_t>(double_);
+  } else {
+    assert(false);
+  }
+}
+
+template<class Alloc>
+double BasicValue<Alloc>::AsDouble() const {
+  if (type_ == Type::kInteger) {
+    return static_cast<double>(integer_);
+  } else if (type_ == Type::kDouble) {
+    return double_;
+  } else {
+    assert(false);
+  }
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::AsBool() const {
+  assert(type_ == Type::kBool);
+  return bool_;
+}
+
+template<class Alloc>
+typename BasicValue<Alloc>::StringType BasicValue<Alloc>::AsString() const {
+  assert(type_ == Type::kString);
+  if (is_borrowed_)
+    return StringType(borrowed_, borrowed_size_);
+  return *string_;
+}
+
+template<class Alloc>
+typename BasicValue<Alloc>::ObjectType BasicValue<Alloc>::AsObject() const {
+  assert(type_ == Type::kObject);
+  return *object_;
+}
+
+template<class Alloc>
+typename BasicValue<Alloc>::ArrayType BasicValue<Alloc>::AsArray() const {
+  assert(type_ == Type::kArray);
+  return *array_;
+}
+
+template<class Alloc>
+const int64_t& BasicValue<Alloc>::GetInteger() const {
+  assert(type_ == Type::kInteger);
+  return integer_;
+}
+
+template<class Alloc>
+const double& BasicValue<Alloc>::GetDouble() const {
+  assert(type_ == Type::kDouble);
+  return double_;
+}
+
+template<class Alloc>
+const bool& BasicValue<Alloc>::GetBool() const {
+  assert(type_ == Type::kBool);
+  return bool_;
+}
+
+template<class Alloc>
+const typename BasicValue<Alloc>::StringType& BasicValue<Alloc>::GetString() const {
+  assert(type_ == Type::kString);
+  assert(!is_borrowed_);
+  return *string_;
+}
+
+template<class Alloc>
+bool BasicValue<Alloc>::IsBorrowedString() const {
+  assert(type_ == Type::kString);
+  return is_borrowed_;
+}
+
+template<class Alloc>
+const char* BasicValue<Alloc>::GetStringData() const {
+  assert(type_ == Type::kString);
+  return is_borrowed_ ? borrowed_ : string_->c_str();
+}
+
+template<class Alloc>
+size_t BasicValue<Alloc>::GetStringSize() const {
+  assert(type_ == Type::kString);
+  return is_borrowed_ ? borrowed_size_ : string_->size();
+}
+
+template<class Alloc>
+const typename BasicValue<Alloc>::ObjectType& BasicValue<Alloc>::GetObject() const {
+  assert(type_ == Type::kObject);
+  return *object_;
+}
+
+template<class Alloc>
+const typename BasicValue<Alloc>::ArrayType& BasicValue<Alloc>::GetArray() const {
+  assert(type_ == Type::kArray);
+  return *array_;
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator[](size_t i) {
+  assert(type_ == Type::kArray);
+  assert(i < array_->Size());
+  return (*array_)[i];
+}
+
+template<class Alloc>
+const BasicValue<Alloc>& BasicValue<Alloc>::operator[](size_t i) const {
+  assert(type_ == Type::kArray);
+  assert(i < array_->Size());
+  return (*array_)[i];
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator[](const StringType& key) {
+  assert(type_ == Type::kObject);
+  return (*object_)[key];
+}
+
+template<class Alloc>
+BasicValue<Alloc>& BasicValue<Alloc>::operator[](StringType&& key) {
+  assert(type_ == Type::kObject);
+  return (*object_)[std::move(key)];
+}
+
+template<class Alloc>
+const BasicValue<Alloc>& BasicValue<Alloc>::operator[](const StringType& key) const {
+  assert(type_ == Type::kObject);
+  const ObjectType& object = *object_;
+  auto itr = object.Find(key);
+  assert(itr != object.End());
+  return itr->second;
+}
+  
+template<class Alloc>
+bool operator==(const BasicObject<Alloc>& left, const BasicObject<Alloc>& right) {
+  if (left.value_.size() != right.value_.size())
+    return false;
+  for (size_t i = 0; i < left.value_.size(); ++i) {
+    const auto& key = left.value_[i].first;
+    size_t j = right.FindIndex(key.data(), key.size());
+    if (j == right.value_.size() || left.value_[i].second != right.value_[j].second)
+      return false;
+  }
+  return true;
+}
+
+template<class Alloc>
+bool operator!=(const BasicObject<Alloc>& left, const BasicObject<Alloc>& right) {
+  return !(left == right);
+}
+
+template<class Alloc>
+bool operator>(const BasicObject<Alloc>& left, const BasicObject<Alloc>& right) {
+  return right < left;
+}
+
+// the members are compared in the order of their keys
+template<class Alloc>
+bool operator<(const BasicObject<Alloc>& left, const BasicObject<Alloc>& right) {
+  auto left_members = left.Sort();
+  auto right_members = right.Sort();
+  return std::lexicographical_compare(
+      left_members.begin(), left_members.end(), 
+      right_members.begin(), right_members.end(), 
+      [] (const typename BasicObject<Alloc>::MemberType* l, 
+          const typename BasicObject<Alloc>::MemberType* r) {
+        return *l < *r;
+      });
+}
+
+template<class Alloc>
+bool operator>=(const BasicObject<Alloc>& left, const BasicObject<Alloc>& right) {
+  return !(left < right);
+}
+
+template<class Alloc>
+bool operator<=(const BasicObject<Alloc>& left, const BasicObject<Alloc>& right) {
+  return !(left > right);
+}
+
+template<class Alloc>
+bool operator==(const BasicArray<Alloc>& left, const BasicArray<Alloc>& right) {
+  return left.value_ == right.value_;
+}
+
+template<class Alloc>
+bool operator!=(const BasicArray<Alloc>& left, const BasicArray<Alloc>& right) {
+  return !(left == right);
+}
+
+template<class Alloc>
+bool operator>(const BasicArray<Alloc>& left, const BasicArray<Alloc>& right) {
+  return left.value_ > right.value_;
+}
+
+template<class Alloc>
+bool operator<(const BasicArray<Alloc>& left, const BasicArray<Alloc>& right) {
+  return left.value_ < right.value_;
+}
+
+template<class Alloc>
+bool operator>=(const BasicArray<Alloc>& left, const BasicArray<Alloc>& right) {
+  return !(left < right);
+}
+
+template<class Alloc>
+bool operator<=(const BasicArray<Alloc>& left, const BasicArray<Alloc>& right) {
+  return !(left > right);
+}
+
+// compare two strings without copying the ones parsed in situ
+template<class Alloc>
+int BasicValue<Alloc>::CompareStrings(const BasicValue& left, const BasicValue& right) {
+  size_t left_size = left.GetStringSize();
+  size_t right_size = right.GetStringSize();
+  int result = memcmp(left.GetStringData(), 
+                      right.GetStringData(), 
+                      std::min(left_size, right_size));
+  if (result)
+    return result;
+  return (left_size < right_size) ? -1 : (left_size > right_size ? 1 : 0);
+}
+
+template<class Alloc>
+bool operator==(const BasicValue<Alloc>& left, const BasicValue<Alloc>& right) {
+  if (left.type_ != right.type_ && (!left.IsNumeric() || !right.IsNumeric()))
+    return false;
+
+  switch (left.type_) {
+  case ValueBase::Type::kBool:
+    return left.bool_ == right.bool_;
+  case ValueBase::Type::kInteger:
+    if (right.type_ == ValueBase::Type::kDouble) {
+      return (static_cast<double>(left.integer_) - right.double_) < 1e-8;
+    } else if (right.type_ == ValueBase::Type::kInteger) {
+      return left.integer_ == right.integer_;
+    } else {
+      return false;
+    }
+  case ValueBase::Type::kDouble:
+    if (right.type_ == ValueBase::Type::kDouble) {
+      return (left.double_ - right.double_) < 1e-8;
+    } else if (right.type_ == ValueBase::Type::kInteger) {
+      return (left.double_ - static_cast<double>(right.integer_)) < 1e-8;
+    } else {
+      return false;
+    }
+  case ValueBase::Type::kString:
+    return BasicValue<Alloc>::CompareStrings(left, right) == 0;
+  case ValueBase::Type::kObject:
+    return *left.object_ == *right.object_;
+  case ValueBase::Type::kArray:
+    return *left.array_ == *right.array_;
+  default: // NullT or DummyT
+    return true;
+  }
+}
+
+template<class Alloc>
+bool operator!=(const BasicValue<Alloc>& left, const BasicValue<Alloc>& right) {
+  return !(left == right);
+}
+
+template<class Alloc>
+bool operator<(const BasicValue<Alloc>& left, const BasicValue<Alloc>& right) {
+  if (left.IsIntegral() && right.IsIntegral()) {
+    return left.integer_ < right.integer_;
+  } else if (left.IsIntegral() && right.IsDouble()) {
+    return static_cast<double>(left.integer_) < right.double_;
+  } else if (left.IsDouble() && right.IsIntegral()) {
+    return left.double_ < static_cast<double>(right.integer_);
+  } else if (left.IsDouble() && right.IsDouble()) {
+    return left.double_ < right.double_;
+  } else if (left.IsString() && right.IsString()) {
+    return BasicValue<Alloc>::CompareStrings(left, right) < 0;
+  } else if (left.IsObject() && right.IsObject()) {
+    return *left.object_ < *right.object_;
+  } else if (left.IsArray() && right.IsArray()) {
+    return *left.array_ < *right.array_;
+  } else {
+    assert(false);
+  }
+  return false;
+}
+
+template<class Alloc>
+bool operator>(const BasicValue<Alloc>& left, const BasicValue<Alloc>& right) {
+  return right < left;
+}
+
+template<class Alloc>
+bool operator<=(const BasicValue<Alloc>& left, const BasicValue<Alloc>& right) {
+  return !(left > right);
+}
+
+template<class Alloc>
+bool operator>=(const BasicValue<Alloc>& left, const BasicValue<Alloc>& right) {
+  return !(left < right);
+}
+
 }  // namespace csonpp
 
 #endif  // CSONPP_CSONPP_H_
@@ -0,0 +1,757 @@
+#ifndef CSONPP_CSONPP_DETAIL_H_
+#define CSONPP_CSONPP_DETAIL_H_
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+/**
+ * the tokenizer and the grammar behind Parser::Parse(), in a header so that
+ * they are inlined with the handler they call. nothing in csonpp::detail is
+ * part of the interface of the library, it may change at any time.
+ */
+
+namespace csonpp {
+namespace detail {
+
+// the number and string scanners of the library, used by the tokenizer
+bool ParseInt64(const char* str, size_t size, int64_t& result);
+bool ParseDouble(const char* str, size_t size, double& result);
+const char* FindStringSpecial(const char* begin, const char* end);
+
+struct Token {
+  enum class Type {
+    kDummy,
+    kLeftBrace,   // {
+    kRightBrace,  // }
+    kLeftBracket, // [
+    kRightBracket,// ]
+    kComma,       // ,
+    kColon,       // :
+    kString,      // "xxx"
+    kInteger,     // integer
+    kDouble,      // -0.99e-5
+    kTrue,        // true
+    kFalse,       // false
+    kNull,        // null
+    kIncomplete,  // the token goes on past the end of the input given so far
+  };
+
+  Type type_;
+  // the decoded body of a kString token, '\0' terminated, or the text of a
+  // kInteger or kDouble token in the input
+  const char* text_;
+  size_t text_size_;
+
+  Token() : type_(Type::kDummy), text_(nullptr), text_size_(0) {}
+
+  bool IsOk() const {
+    return type_ != Type::kDummy;
+  }
+};
+
+// where stage 1 of the parser stopped in an input, see Tokenizer::UseIndex():
+// the next block of 64 bytes to classify and what the previous one carries
+struct IndexState {
+  size_t base;
+  // 1 if the first charactor of the block is escaped
+  uint64_t escaped;
+  // all ones if the block starts in a string
+  uint64_t in_string;
+  // 1 if the block starts in the middle of a scalar
+  uint64_t scalar;
+
+  IndexState() : base(0), escaped(0), in_string(0), scalar(0) {}
+};
+
+/**
+ * the tokenizer of every parser, in the header so that Parser::Parse()
+ * is inlined with the handler it calls.
+ * the input may be given in parts: as long as the last part is not given,
+ * a token running past the end of the input is reported as kIncomplete.
+ * the input then goes on with Continue(), from GetKeepPosition() on, and
+ * the next GetToken() resumes the token where it stopped: the part of a
+ * string already read is decoded and a number keeps its DFA state, so no
+ * byte is scanned twice however the input is cut.
+ * a whole input may rather be indexed, see UseIndex(): GetToken() then
+ * jumps from one structural position to the next instead of skipping the
+ * whitespaces between the tokens.
+ */
+class Tokenizer {
+ public:
+  Tokenizer(const char* csonpp_str, size_t size) {
+    Reset(csonpp_str, size);
+  }
+
+  ~Tokenizer() {
+  }
+
+  // start over on another input, the last part of it unless last is false
+  void Reset(const char* csonpp_str, size_t size, bool last = true) {
+    assert(csonpp_str || !size);
+    csonpp_str_ = csonpp_str;
+    size_ = size;
+    cur_pos_ = 0;
+    last_ = last;
+    insitu_str_ = nullptr;
+    pending_ = Pending::kNone;
+    indexed_ = false;
+  }
+
+  // the input goes on in csonpp_str, which starts with the bytes of the
+  // previous part from GetKeepPosition() on
+  void Continue(const char* csonpp_str, size_t size, bool last) {
+    assert(csonpp_str || !size);
+    assert(!indexed_);
+    size_t keep = GetKeepPosition();
+    cur_pos_ -= keep;
+    if (pending_ == Pending::kNumber)
+      token_start_ -= keep;
+    csonpp_str_ = csonpp_str;
+    size_ = size;
+    last_ = last;
+  }
+
+  // csonpp_str is the writable input, strings are then decoded
+  // into the input itself
+  void SetInSitu(char* csonpp_str) {
+    assert(csonpp_str == csonpp_str_ && last_);
+    insitu_str_ = csonpp_str;
+  }
+
+  bool IsInSitu() const {
+    return insitu_str_ != nullptr;
+  }
+
+  // read the input, which must be whole and not read yet, from the
+  // positions of its structural charactors and of the starts of its
+  // scalars. they are found by stage 1, csonpp::IndexBlocks(), a few
+  // thousand bytes ahead of the tokens, or all at once in situ since
+  // decoding a string overwrites it. false if the input is too large
+  bool UseIndex();
+
+  bool IsLast() const {
+    return last_;
+  }
+
+  // how much of the input is consumed
+  size_t GetPosition() const {
+    return std::min(cur_pos_, size_);
+  }
+
+  // where the bytes still needed by the next GetToken() start
+  size_t GetKeepPosition() const {
+    return std::min(pending_ == Pending::kNumber ? token_start_ : cur_pos_, size_);
+  }
+
+  // the buffer a string is decoded into, unless in situ,
+  // it may be taken by the caller
+  std::string& GetStringBuffer() {
+    return string_;
+  }
+
+  Token GetToken();
+
+  // skip the whitespaces, true if nothing else is left
+  bool AtEnd();
+
+ private:
+  // the token a kIncomplete GetToken() stopped in
+  enum class Pending {
+    kNone,
+    kString,
+    kNumber,
+  };
+
+  // the states of the number DFA, see GetToken()
+  enum class NumberState {
+    kNumber1,
+    kNumber2,
+    kNumber3,
+    kNumber4,
+    kNumber5,
+    kNumber6,
+    kNumber7,
+  };
+
+  const char* csonpp_str_;
+  size_t size_;
+  size_t cur_pos_;
+  bool last_;
+  char* insitu_str_;
+
+  Pending pending_;
+  NumberState number_state_;
+  // where the pending number starts
+  size_t token_start_;
+  std::string string_;
+
+  bool indexed_;
+  IndexState index_state_;
+  // the positions found so far by stage 1 are [next_, index_size_),
+  // the buffer is kept for the next input
+  std::vector<uint32_t> index_;
+  size_t next_;
+  size_t index_size_;
+
+  // reading past the end yields '\0'
+  int GetNextChar() {
+    if (cur_pos_ >= size_) {
+      ++cur_pos_;
+      return '\0';
+    }
+    return static_cast<unsigned char>(csonpp_str_[cur_pos_++]);
+  }
+
+  // the token starting at cur_pos_
+  Token ReadToken();
+  Token GetIndexedToken();
+  // the next position of the index, size_ past the last one
+  size_t PeekIndex() {
+    if (next_ == index_size_ && !RefillIndex())
+      return size_;
+    return index_[next_];
+  }
+  // run stage 1 on the next blocks, false at the end of the input
+  bool RefillIndex();
+  Token GetLiteral(const char* rest, size_t size, Token::Type type);
+  Token GetString();
+  Token GetStringInSitu();
+  Token GetNumber();
+  Token Incomplete();
+  Token Error();
+  // whether the escape at cur_pos_ is whole in the input
+  bool IsEscapeWhole() const;
+  size_t DecodeEscape(char* decoded);
+  int32_t DecodeUnicode();
+};
+
+/**
+ * the grammar of a document, shared by Parser::Parse(), Parser, Reader and
+ * PushParser: every Next() reads the document up to its next part and calls
+ * the handler for it, see Parser::Parse(). it is a template over the handler
+ * so that the tokenizer, the grammar and the handler are compiled into
+ * one loop.
+ * the input may be given in parts like to a Tokenizer: kMore is returned
+ * once the part given so far is read, and the input goes on with Continue().
+ */
+class ParserCore {
+ public:
+  enum class Status {
+    kPart,   /* the handler is called for the next part of the document */
+    kEnd,    /* the whole document is read */
+    kError,  /* the document is invalid or a handler returned false */
+    kMore,   /* the input given so far is read */
+  };
+
+  explicit ParserCore(size_t max_depth)
+      : tokenizer_(nullptr, 0),
+        max_depth_(max_depth),
+        state_(State::kValue) {}
+
+  // start over on another input, the last part of it unless last is false
+  void Reset(const char* csonpp_str, size_t size, bool last = true) {
+    tokenizer_.Reset(csonpp_str, size, last);
+    stack_.clear();
+    state_ = State::kValue;
+  }
+
+  // see Tokenizer::Continue()
+  void Continue(const char* csonpp_str, size_t size, bool last) {
+    tokenizer_.Continue(csonpp_str, size, last);
+  }
+
+  Tokenizer& GetTokenizer() {
+    return tokenizer_;
+  }
+
+  // a string is given to handler.String() and a key to handler.Key()
+  // in the buffer of the tokenizer, as a std::string& the handler may take
+  template<class Handler>
+  Status Next(Handler& handler) {
+    return Step<Handler, false>(handler);
+  }
+
+  // the same on an input set in situ on the tokenizer, but a string is given
+  // to handler.String(const char* str, size_t size) where it lies in the input
+  template<class Handler>
+  Status NextInSitu(Handler& handler) {
+    return Step<Handler, true>(handler);
+  }
+
+ private:
+  // what the next token may be
+  enum class State {
+    kValue,         // a value
+    kFirstMember,   // after '{'
+    kMember,        // after ',' in an object
+    kColon,         // after a key
+    kFirstElement,  // after '['
+    kNext,          // after a value in an object or an array
+    kEnd,           // after the document
+    kError,
+  };
+
+  Tokenizer tokenizer_;
+  size_t max_depth_;
+  // the open containers, true for an object
+  std::vector<bool> stack_;
+  State state_;
+
+  template<class Handler, bool kInSitu>
+  Status Step(Handler& handler);
+  template<class Handler, bool kInSitu>
+  Status ReadValue(Handler& handler, const Token& token);
+
+  template<class Handler>
+  bool String(Handler& handler, const Token&, std::false_type) {
+    return handler.String(tokenizer_.GetStringBuffer());
+  }
+
+  template<class Handler>
+  bool String(Handler& handler, const Token& token, std::true_type) {
+    return handler.String(token.text_, token.text_size_);
+  }
+
+  // what follows a handler call
+  Status Emit(bool ok) {
+    return ok ? Status::kPart : Error();
+  }
+
+  Status ValueDone(bool ok) {
+    state_ = stack_.empty() ? State::kEnd : State::kNext;
+    return Emit(ok);
+  }
+
+  Status ContainerDone(bool ok) {
+    stack_.pop_back();
+    return ValueDone(ok);
+  }
+
+  Status Error() {
+    state_ = State::kError;
+    return Status::kError;
+  }
+};
+
+inline Token Tokenizer::GetToken() {
+  /**
+   * The DFA
+   * kStart + 'n'(ull)   -> END (null)
+   * kStart + 'f'(alse)  -> END (false)
+   * kStart + 't'(rue)   -> END (true)
+   * kStart + ':'        -> END (:)
+   * kStart + ','        -> END (,)
+   * kStart + '['        -> END ([)
+   * kStart + ']'        -> END (])
+   * kStart + '{'        -> END ({)
+   * kStart + '}'        -> END (})
+   * kStart + '\"'       -> END (String), the body is decoded by GetString()
+   * kStart + '-'        -> kNumber1
+   * kStart + '[1-9]'    -> kNumber2
+   * kNumber1 + '[1-9]' -> kNumber2
+   * kNumber1 + '0'     -> kNumber3
+   * kNumber2 + '[0-9]' -> kNumber2
+   * kNumber2 + '.'     -> kNumber4
+   * kNumber2 + '[eE]'  -> kNumber5
+   * kNumber2 + '[,}\]]'-> DONE (Integer)
+   * kNumber3 + '.'     -> kNumber4
+   * kNumber3 + '[,}\]]'-> DONE (Integer)
+   * kNumber4 + '[0-9]' -> kNumber4
+   * kNumber4 + '[eE]'  -> kNumber5
+   * kNumber4 + '[,}\]]'-> DONE (Double)
+   * kNumber5 + '[+-]'  -> kNumber6
+   * kNumber5 + '[0-9]' -> kNumber7
+   * kNumber6 + '[0-9]' -> kNumber7
+   * kNumber7 + '[0-9]' -> kNumber7
+   * kNumber7 + '[,}\]]'-> DONE (Double)
+   * a whitespace or the end of the input ends a number just like '[,}\]]'
+   */
+  if (indexed_)
+    return GetIndexedToken();
+
+  switch (pending_) {
+  case Pending::kString:
+    return GetString();
+  case Pending::kNumber:
+    return GetNumber();
+  default:
+    break;
+  }
+
+  while (cur_pos_ < size_ && 
+         isspace(static_cast<unsigned char>(csonpp_str_[cur_pos_]))) {
+    ++cur_pos_;
+  }
+  if (cur_pos_ >= size_)
+    return last_ ? Error() : Incomplete();
+  return ReadToken();
+}
+
+inline Token Tokenizer::ReadToken() {
+  Token token;
+  switch (csonpp_str_[cur_pos_++]) {
+  case ',':
+    token.type_ = Token::Type::kComma;
+    return token;
+  case ':':
+    token.type_ = Token::Type::kColon;
+    return token;
+  case '{':
+    token.type_ = Token::Type::kLeftBrace;
+    return token;
+  case '}':
+    token.type_ = Token::Type::kRightBrace;
+    return token;
+  case '[':
+    token.type_ = Token::Type::kLeftBracket;
+    return token;
+  case ']':
+    token.type_ = Token::Type::kRightBracket;
+    return token;
+  case 't':
+    return GetLiteral("rue", 3, Token::Type::kTrue);
+  case 'f':
+    return GetLiteral("alse", 4, Token::Type::kFalse);
+  case 'n':
+    return GetLiteral("ull", 3, Token::Type::kNull);
+  case '\"':
+    if (insitu_str_)
+      return GetStringInSitu();
+    string_.clear();
+    pending_ = Pending::kString;
+    return GetString();
+  case '-':
+    number_state_ = NumberState::kNumber1;
+    break;
+  case '0':
+    number_state_ = NumberState::kNumber3;
+    break;
+  case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9':
+    number_state_ = NumberState::kNumber2;
+    break;
+  default:
+    return Error();
+  }
+  pending_ = Pending::kNumber;
+  token_start_ = cur_pos_ - 1;
+  return GetNumber();
+}
+
+/**
+ * the index holds every charactor out of a string but the whitespaces and
+ * the ones continuing a scalar, so only whitespaces lie between a token and
+ * the next position as long as a scalar ends at a whitespace, at one of
+ * ",}]" or at the end of the input. the number DFA makes sure of it, a
+ * literal is checked here.
+ */
+inline Token Tokenizer::GetIndexedToken() {
+  cur_pos_ = PeekIndex();
+  if (cur_pos_ == size_)
+    return Error();
+  ++next_;
+  Token token = ReadToken();
+  switch (token.type_) {
+  case Token::Type::kTrue:
+  case Token::Type::kFalse:
+  case Token::Type::kNull:
+    if (cur_pos_ < size_) {
+      int c = static_cast<unsigned char>(csonpp_str_[cur_pos_]);
+      if (c != ',' && c != '}' && c != ']' && !isspace(c))
+        return Error();
+    }
+    break;
+  default:
+    break;
+  }
+  return token;
+}
+
+// the rest of a literal whose first charactor is consumed
+inline Token Tokenizer::GetLiteral(const char* rest, size_t size, Token::Type type) {
+  size_t left = size_ - cur_pos_;
+  if (left < size) {
+    if (last_ || memcmp(csonpp_str_ + cur_pos_, rest, left) != 0)
+      return Error();
+    // read again from its first charactor once the input goes on
+    --cur_pos_;
+    return Incomplete();
+  }
+  if (memcmp(csonpp_str_ + cur_pos_, rest, size) != 0)
+    return Error();
+  cur_pos_ += size;
+  Token token;
+  token.type_ = type;
+  return token;
+}
+
+/**
+ * decode the body of a string into string_ up to its closing '"',
+ * the runs without escapes are appended as they are.
+ * the string is left pending at the end of the input, and an escape
+ * is only decoded once it is whole.
+ */
+inline Token Tokenizer::GetString() {
+  char decoded[4];
+  while (true) {
+    const char* run = csonpp_str_ + cur_pos_;
+    const char* run_end = FindStringSpecial(run, csonpp_str_ + size_);
+    string_.append(run, run_end);
+    cur_pos_ += run_end - run;
+    if (cur_pos_ >= size_)
+      return last_ ? Error() : Incomplete();
+
+    char c = csonpp_str_[cur_pos_];
+    if (c == '\"') {
+      ++cur_pos_;
+      pending_ = Pending::kNone;
+      Token token;
+      token.type_ = Token::Type::kString;
+      token.text_ = string_.c_str();
+      token.text_size_ = string_.size();
+      return token;
+    } else if (c == '\\') {
+      if (!last_ && !IsEscapeWhole())
+        return Incomplete();
+      ++cur_pos_;
+      size_t size = DecodeEscape(decoded);
+      if (!size)
+        return Error();
+      string_.append(decoded, size);
+    } else if (c == '\0') {
+      return Error();
+    } else {
+      string_.append(1, c);
+      ++cur_pos_;
+    }
+  }
+}
+
+// run the number DFA from number_state_ until the number ends
+inline Token Tokenizer::GetNumber() {
+  while (true) {
+    // -1 at the end of the input, which ends a number too
+    int c = -1;
+    if (cur_pos_ < size_)
+      c = static_cast<unsigned char>(csonpp_str_[cur_pos_]);
+    else if (!last_)
+      return Incomplete();
+    bool is_digit = (c >= '0' && c <= '9');
+    bool is_end = (c < 0 || c == ',' || c == '}' || c == ']' || isspace(c));
+
+    switch (number_state_) {
+    case NumberState::kNumber1:
+      if (c == '0')
+        number_state_ = NumberState::kNumber3;
+      else if (is_digit)
+        number_state_ = NumberState::kNumber2;
+      else
+        return Error();
+      break;
+    case NumberState::kNumber2:
+    case NumberState::kNumber3:
+      if (is_digit && number_state_ == NumberState::kNumber2)
+        break;
+      if (c == '.')
+        number_state_ = NumberState::kNumber4;
+      else if (c == 'e' || c == 'E')
+        number_state_ = NumberState::kNumber5;
+      else if (!is_end)
+        return Error();
+      break;
+    case NumberState::kNumber4:
+      if (c == 'e' || c == 'E')
+        number_state_ = NumberState::kNumber5;
+      else if (!is_digit && !is_end)
+        return Error();
+      break;
+    case NumberState::kNumber5:
+      if (is_digit)
+        number_state_ = NumberState::kNumber7;
+      else if (c == '+' || c == '-')
+        number_state_ = NumberState::kNumber6;
+      else
+        return Error();
+      break;
+    case NumberState::kNumber6:
+      if (is_digit)
+        number_state_ = NumberState::kNumber7;
+      else
+        return Error();
+      break;
+    case NumberState::kNumber7:
+      if (!is_digit && !is_end)
+        return Error();
+      break;
+    }
+
+    if (is_end) {
+      pending_ = Pending::kNone;
+      Token token;
+      token.type_ = (number_state_ == NumberState::kNumber2 || 
+                     number_state_ == NumberState::kNumber3) ? 
+                    Token::Type::kInteger : Token::Type::kDouble;
+      token.text_ = csonpp_str_ + token_start_;
+      token.text_size_ = cur_pos_ - token_start_;
+      return token;
+    }
+    ++cur_pos_;
+  }
+}
+
+inline Token Tokenizer::Incomplete() {
+  Token token;
+  token.type_ = Token::Type::kIncomplete;
+  return token;
+}
+
+inline Token Tokenizer::Error() {
+  pending_ = Pending::kNone;
+  return Token();
+}
+
+/**
+ * a '\\' is followed by one charactor, or by 'u' and 4 hex digits,
+ * and by a second "\\uXXXX" after a high surrogate
+ */
+inline bool Tokenizer::IsEscapeWhole() const {
+  const char* escape = csonpp_str_ + cur_pos_;
+  size_t left = size_ - cur_pos_;
+  if (left < 2)
+    return false;
+  if (escape[1] != 'u')
+    return true;
+  if (left < 6)
+    return false;
+  bool high_surrogate = (escape[2] == 'd' || escape[2] == 'D') && 
+                        memchr("89abAB", escape[3], 6) != nullptr;
+  return !high_surrogate || left >= 12;
+}
+
+inline bool Tokenizer::AtEnd() {
+  if (indexed_) {
+    cur_pos_ = PeekIndex();
+    return cur_pos_ == size_;
+  }
+  while (cur_pos_ < size_ && 
+         isspace(static_cast<unsigned char>(csonpp_str_[cur_pos_]))) {
+    ++cur_pos_;
+  }
+  return cur_pos_ >= size_;
+}
+
+/**
+ * the tokens that call no handler, i.e. ',' and ':', are read in a loop,
+ * so that a call returns with exactly one part of the document
+ */
+template<class Handler, bool kInSitu>
+ParserCore::Status ParserCore::Step(Handler& handler) {
+  while (true) {
+    switch (state_) {
+    case State::kEnd:
+      // nothing but whitespaces may follow the document
+      if (!tokenizer_.AtEnd())
+        return Error();
+      return tokenizer_.IsLast() ? Status::kEnd : Status::kMore;
+    case State::kError:
+      return Status::kError;
+    default:
+      break;
+    }
+
+    Token token = tokenizer_.GetToken();
+    if (token.type_ == Token::Type::kIncomplete)
+      return Status::kMore;
+    switch (state_) {
+    case State::kValue:
+      return ReadValue<Handler, kInSitu>(handler, token);
+    case State::kFirstMember:
+      if (token.type_ == Token::Type::kRightBrace)
+        return ContainerDone(handler.EndObject());
+      // fall through
+    case State::kMember: {
+      if (token.type_ != Token::Type::kString)
+        return Error();
+      std::string& key = tokenizer_.GetStringBuffer();
+      if (kInSitu)
+        key.assign(token.text_, token.text_size_);
+      state_ = State::kColon;
+      return Emit(handler.Key(key));
+    }
+    case State::kColon:
+      if (token.type_ != Token::Type::kColon)
+        return Error();
+      state_ = State::kValue;
+      break;
+    case State::kFirstElement:
+      if (token.type_ == Token::Type::kRightBracket)
+        return ContainerDone(handler.EndArray());
+      return ReadValue<Handler, kInSitu>(handler, token);
+    case State::kNext:
+      if (token.type_ == Token::Type::kComma) {
+        state_ = stack_.back() ? State::kMember : State::kValue;
+        break;
+      }
+      if (token.type_ == Token::Type::kRightBrace && stack_.back())
+        return ContainerDone(handler.EndObject());
+      if (token.type_ == Token::Type::kRightBracket && !stack_.back())
+        return ContainerDone(handler.EndArray());
+      return Error();
+    default:
+      return Error();
+    }
+  }
+}
+
+template<class Handler, bool kInSitu>
+ParserCore::Status ParserCore::ReadValue(Handler& handler, const Token& token) {
+  switch (token.type_) {
+  case Token::Type::kLeftBrace:
+    if (stack_.size() >= max_depth_)
+      return Error();
+    stack_.push_back(true);
+    state_ = State::kFirstMember;
+    return Emit(handler.StartObject());
+  case Token::Type::kLeftBracket:
+    if (stack_.size() >= max_depth_)
+      return Error();
+    stack_.push_back(false);
+    state_ = State::kFirstElement;
+    return Emit(handler.StartArray());
+  case Token::Type::kString:
+    return ValueDone(String(handler, token, std::integral_constant<bool, kInSitu>()));
+  case Token::Type::kInteger: {
+    int64_t integer = 0;
+    if (!ParseInt64(token.text_, token.text_size_, integer))
+      return Error();
+    return ValueDone(handler.Int64(integer));
+  }
+  case Token::Type::kDouble: {
+    double num = 0.;
+    if (!ParseDouble(token.text_, token.text_size_, num))
+      return Error();
+    return ValueDone(handler.Double(num));
+  }
+  case Token::Type::kTrue:
+    return ValueDone(handler.Bool(true));
+  case Token::Type::kFalse:
+    return ValueDone(handler.Bool(false));
+  case Token::Type::kNull:
+    return ValueDone(handler.Null());
+  default:
+    return Error();
+  }
+}
+
+}  // namespace detail
+}  // namespace csonpp
+
+#endif  // CSONPP_CSONPP_DETAIL_H_
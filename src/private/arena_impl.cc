@@ -0,0 +1,55 @@
+#include "csonpp_impl.h"
+
+#include <stdlib.h>
+#include <new>
+
+namespace csonpp {
+
+Arena::Arena(size_t block_size)
+    : block_size_(block_size),
+      block_(nullptr),
+      cur_(nullptr),
+      end_(nullptr) {
+}
+
+Arena::~Arena() {
+  for (size_t i = 0; i < blocks_.size(); ++i)
+    free(blocks_[i]);
+}
+
+void Arena::Clear() {
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    if (blocks_[i] != block_)
+      free(blocks_[i]);
+  }
+  blocks_.clear();
+  if (block_)
+    blocks_.push_back(block_);
+  cur_ = block_;
+}
+
+/**
+ * malloc() aligns a block for any type.
+ * what takes more than a quarter of a block gets a block of its own,
+ * so that the rest of the current block is not wasted.
+ */
+void* Arena::AllocateSlow(size_t size) {
+  if (size > block_size_ / 4) {
+    char* block = static_cast<char*>(malloc(size ? size : 1));
+    if (!block)
+      throw std::bad_alloc();
+    blocks_.push_back(block);
+    return block;
+  }
+
+  char* block = static_cast<char*>(malloc(block_size_));
+  if (!block)
+    throw std::bad_alloc();
+  blocks_.push_back(block);
+  block_ = block;
+  cur_ = block + size;
+  end_ = block + block_size_;
+  return block;
+}
+
+}  // namespace csonpp
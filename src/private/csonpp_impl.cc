@@ -1,906 +1,36 @@
 #include "csonpp_impl.h"
 
 #include <assert.h>
+#include <string.h>
 #include <algorithm>
+#include <chrono>
+#include <random>
 
 namespace csonpp {
 
-Object::Object(const Object& other)
-    : value_(other.value_) {
-}
-
-Object::Object(Object&& other) 
-: value_(std::move(other.value_)) {
-}
-
-Object& Object::operator=(const Object& other) {
-  if (this != &other)
-    value_ = other.value_;
-  return *this;
-}
-
-Object& Object::operator=(Object&& other) {
-  if (this != &other)
-    value_ = std::move(other.value_);
-  return *this;
-}
-
-Value& Object::operator[](const std::string& key) {
-  return value_[key];
-}
-
-Value& Object::operator[](std::string&& key) {
-  return value_[std::move(key)];
-}
-
-Object::ConstIterator Object::CBegin() const {
-  return value_.cbegin();
-}
-
-Object::ConstIterator Object::CEnd() const {
-  return value_.cend();
-}
-
-Object::ConstIterator Object::Begin() const {
-  return value_.begin();
-}
-
-Object::ConstIterator Object::End() const {
-  return value_.end();
-}
-
-Object::Iterator Object::Begin() {
-  return value_.begin();
-}
-
-Object::Iterator Object::End() {
-  return value_.end();
-}
-
-Object::Iterator Object::Find(const std::string& key) {
-  return value_.find(key);
-}
-
-Object::ConstIterator Object::Find(const std::string& key) const {
-  return value_.find(key);
-}
-
-void Object::Clear() {
-  value_.clear();
-}
-size_t Object::Size() const {
-  return value_.size();
-}
-
-Array::Array(const Array& array) 
-: value_(array.value_) {
-}
-
-Array::Array(Array&& array) 
-: value_(std::move(array.value_)) {
-}
-
-Array& Array::operator=(const Array& array) {
-  if (this != &array)
-    value_ = array.value_;
-  return *this;
-}
-
-Array& Array::operator=(Array&& array) {
-  if (this != &array)
-    value_ = std::move(array.value_);
-  return *this;
-}
-
-// the element must exist
-Value& Array::operator[](size_t i) {
-  assert(i < value_.size());
-  return value_[i];
-}
-
-// the element must exist
-const Value& Array::operator[](size_t i) const {
-  assert(i < value_.size());
-  return value_[i];
-}
-
-void Array::Append(const Value& value) {
-  value_.push_back(value);
-}
-
-void Array::Append(Value&& value) {
-  value_.push_back(std::move(value));
-}
-
-Array::ConstIterator Array::CBegin() const {
-  return value_.cbegin();
-}
-
-Array::ConstIterator Array::CEnd() const {
-  return value_.cend();
-}
-
-Array::ConstIterator Array::Begin() const {
-  return value_.begin();
-}
-
-Array::ConstIterator Array::End() const {
-  return value_.end();
-}
-
-Array::Iterator Array::Begin() {
-  return value_.begin();
-}
-
-Array::Iterator Array::End() {
-  return value_.end();
-}
-
-Array::Iterator Array::Find(const Value& value) {
-  return std::find(Begin(), End(), value);
-}
-
-Array::ConstIterator Array::Find(const Value& value) const {
-  return std::find(Begin(), End(), value);
-}
-
-void Array::Clear() {
-  value_.clear();
-}
-
-size_t Array::Size() const {
-  return value_.size();
-}
-
-Value::Value(Type type)
-    : type_(type) {
-}
-
-Value::Value(std::nullptr_t null)
-    : type_(Type::kNull) {
-}
-
-Value::Value(bool value) 
-: type_(Type::kBool), 
-  bool_(value) {
-}
-
-Value::Value(int8_t value) 
-: type_(Type::kInteger), 
-  integer_(static_cast<int64_t>(value)) {
-}
-
-Value::Value(uint8_t value) 
-: type_(Type::kInteger), 
-  integer_(static_cast<int64_t>(value)) {
-}
-
-Value::Value(int16_t value) 
-: type_(Type::kInteger), 
-  integer_(static_cast<int64_t>(value)) {
-}
-
-Value::Value(uint16_t value) 
-: type_(Type::kInteger), 
-  integer_(static_cast<int64_t>(value)) {
-}
-
-Value::Value(int32_t value) 
-: type_(Type::kInteger), 
-  integer_(static_cast<int64_t>(value)) {
-}
-
-Value::Value(uint32_t value) 
-: type_(Type::kInteger), 
-  integer_(static_cast<int64_t>(value)) {
-}
-
-Value::Value(int64_t value) 
-: type_(Type::kInteger), 
-  integer_(value) {
-}
-
-// TODO
-// do not support uint64_t
-#if 0
-Value::Value(uint64_t value) 
-: type_(Type::kInteger), 
-  integer_(value) {
-}
-#endif
-
-Value::Value(float value) 
-: type_(Type::kDouble), 
-  double_(static_cast<double>(value)) {
-}
-
-Value::Value(double value) 
-: type_(Type::kDouble), 
-  double_(value) {
-}
-
-Value::Value(const std::string& value) 
-: type_(Type::kString), 
-  string_(value) {
-}
-
-Value::Value(std::string&& value) 
-: type_(Type::kString), 
-  string_(std::move(value)) {
-}
-
-Value::Value(const Object& value) 
-: type_(Type::kObject), 
-  object_(value) {
-}
-
-Value::Value(Object&& value) 
-: type_(Type::kObject), 
-  object_(std::move(value)) {
-}
-
-Value::Value(const Array& value) 
-: type_(Type::kArray), 
-  array_(value) {
-}
-
-Value::Value(Array&& value) 
-: type_(Type::kArray), 
-  array_(std::move(value)) {
-}
-
-Value::Value(const Value& value) 
-: type_(value.type_) {
-  switch(type_) {
-  case Type::kBool:
-    bool_ = value.bool_;
-    break;
-  case Type::kInteger:
-    integer_ = value.integer_;
-    break;
-  case Type::kDouble:
-    double_ = value.double_;
-    break;
-  case Type::kString:
-    string_ = value.string_;
-    break;
-  case Type::kObject:
-    object_ = value.object_;
-    break;
-  case Type::kArray:
-    array_ = value.array_;
-    break;
-  default:
-    break;
-  }
-}
-
-Value::Value(Value&& value) 
-: type_(value.type_) {
-  switch(type_) {
-  case Type::kBool:
-    bool_ = value.bool_;
-    break;
-  case Type::kInteger:
-    integer_ = value.integer_;
-    break;
-  case Type::kDouble:
-    double_ = value.double_;
-    break;
-  case Type::kString:
-    string_ = std::move(value.string_);
-    break;
-  case Type::kObject:
-    object_ = std::move(value.object_);
-    break;
-  case Type::kArray:
-    array_ = std::move(value.array_);
-    break;
-  default:
-    break;
-  }
-}
-
-Value& Value::operator=(const Value& value) {
-  if (&value != this) {
-    type_ = value.type_;
-    switch(type_) {
-    case Type::kBool:
-      bool_ = value.bool_;
-      break;
-    case Type::kInteger:
-      integer_ = value.integer_;
-      break;
-    case Type::kDouble:
-      double_ = value.double_;
-      break;
-    case Type::kString:
-      string_ = value.string_;
-      break;
-    case Type::kObject:
-      object_ = value.object_;
-      break;
-    case Type::kArray:
-      array_ = value.array_;
-      break;
-    default:
-      break;
-    }
-  }
-
-  return *this;
-}
-
-Value& Value::operator=(Value&& value) {
-  if (&value != this) {
-    type_ = value.type_;
-    switch(type_) {
-    case Type::kBool:
-      bool_ = value.bool_;
-      break;
-    case Type::kInteger:
-      integer_ = value.integer_;
-      break;
-    case Type::kDouble:
-      double_ = value.double_;
-      break;
-    case Type::kString:
-      string_ = std::move(value.string_);
-      break;
-    case Type::kObject:
-      object_ = std::move(value.object_);
-      break;
-    case Type::kArray:
-      array_ = std::move(value.array_);
-      break;
-    default:
-      break;
-    }
-  }
-
-  return *this;
-}
-
-Value& Value::operator=(bool value) {
-  type_ = Type::kBool;
-  bool_ = value;
-  return *this;
-}
-
-Value& Value::operator=(int8_t value) {
-  type_ = Type::kInteger;
-  integer_ = static_cast<int64_t>(value);
-  return *this;
-}
-
-Value& Value::operator=(uint8_t value) {
-  type_ = Type::kInteger;
-  integer_ = static_cast<int64_t>(value);
-  return *this;
-}
-
-Value& Value::operator=(int16_t value) {
-  type_ = Type::kInteger;
-  integer_ = static_cast<int64_t>(value);
-  return *this;
-}
-
-Value& Value::operator=(uint16_t value) {
-  type_ = Type::kInteger;
-  integer_ = static_cast<int64_t>(value);
-  return *this;
-}
-
-Value& Value::operator=(int32_t value) {
-  type_ = Type::kInteger;
-  integer_ = static_cast<int64_t>(value);
-  return *this;
-}
-
-Value& Value::operator=(uint32_t value) {
-  type_ = Type::kInteger;
-  integer_ = static_cast<int64_t>(value);
-  return *this;
-}
-
-Value& Value::operator=(int64_t value) {
-  type_ = Type::kInteger;
-  integer_ = value;
-  return *this;
-}
-
-// TODO
-// do not support uint64_t
-#if 0
-Value& Value::operator=(uint64_t value) {
-  type_ = Type::kInteger;
-  integer_ = value;
-  return *this;
-}
-#endif
-
-Value& Value::operator=(float value) {
-  type_ = Type::kDouble;
-  double_ = static_cast<double>(value);
-  return *this;
-}
-
-Value& Value::operator=(double value) {
-  type_ = Type::kDouble;
-  double_ = value;
-  return *this;
-}
-
-Value& Value::operator=(const std::string& value) {
-  type_ = Type::kString;
-  string_ = value;
-  return *this;
-}
-
-Value& Value::operator=(std::string&& value) {
-  type_ = Type::kString;
-  string_ = std::move(value);
-  return *this;
-}
-
-Value& Value::operator=(const Object& value) {
-  type_ = Type::kObject;
-  object_ = value;
-  return *this;
-}
-
-Value& Value::operator=(Object&& value) {
-  type_ = Type::kObject;
-  object_ = std::move(value);
-  return *this;
-}
-
-Value& Value::operator=(const Array& value) {
-  type_ = Type::kArray;
-  array_ = value;
-  return *this;
-}
-
-Value& Value::operator=(Array&& value) {
-  type_ = Type::kArray;
-  array_ = std::move(value);
-  return *this;
-}
-
-void Value::Append(const Value& value) {
-  assert(type_ == Type::kArray);
-  array_.Append(value);
-}
-
-void Value::Append(Value&& value) {
-  assert(type_ == Type::kArray);
-  array_.Append(std::move(value));
-}
-
-void Value::Append(const std::string& key, bool value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, bool value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, int8_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, int8_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, uint8_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, uint8_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, int16_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, uint16_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, int32_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, int32_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, uint32_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, uint32_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, int64_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, int64_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-// TODO
-// do not support uint64_t
-#if 0
-void Value::Append(const std::string& key, uint64_t value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, uint64_t value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-#endif
-
-void Value::Append(const std::string& key, float value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, float value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, double value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, double value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, const std::string& value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, const std::string& value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, std::string&& value) {
-  assert(type_ == Type::kObject);
-  object_[key] = std::move(value);
-}
-
-void Value::Append(std::string&& key, std::string&& value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = std::move(value);
-}
-
-void Value::Append(const std::string& key, const Object& value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, const Object& value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, Object&& value) {
-  assert(type_ == Type::kObject);
-  object_[key] = std::move(value);
-}
-
-void Value::Append(std::string&& key, Object&& value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = std::move(value);
-}
-
-void Value::Append(const std::string& key, const Array& value) {
-  assert(type_ == Type::kObject);
-  object_[key] = value;
-}
-
-void Value::Append(std::string&& key, const Array& value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = value;
-}
-
-void Value::Append(const std::string& key, Array&& value) {
-  assert(type_ == Type::kObject);
-  object_[key] = std::move(value);
-}
-
-void Value::Append(std::string&& key, Array&& value) {
-  assert(type_ == Type::kObject);
-  object_[std::move(key)] = std::move(value);
-}
-
-Value::Type Value::GetType() const {
-  return type_;
-}
-
-size_t Value::Size() const {
-  assert(type_ == Type::kObject || type_ == Type::kArray);
-  return (type_ == Type::kObject) ? object_.Size() : array_.Size();
-}
-
-void Value::Clear() {
-  switch (type_) {
-  case Type::kArray:
-    array_.Clear();
-    return;
-  case Type::kObject:
-    object_.Clear();
-    return;
-  default:
-    assert(false);
-    return;
-  }
-}
-
-bool Value::IsNumeric() const {
-  return (type_ == Type::kDouble || type_ == Type::kInteger);
-}
-
-bool Value::IsIntegral() const {
-  return type_ == Type::kInteger;
-}
-
-bool Value::IsDouble() const {
-  return type_ == Type::kDouble;
-}
-
-bool Value::IsBool() const {
-  return type_ == Type::kBool;
-}
-
-bool Value::IsString() const {
-  return type_ == Type::kString;
-}
-
-bool Value::IsObject() const {
-  return type_ == Type::kObject;
-}
-
-bool Value::IsArray() const {
-  return type_ == Type::kArray;
-}
-
-int64_t Value::AsInteger() const {
-  if (type_ == Type::kInteger) {
-    return integer_;
-  } else if (type_ == Type::kDouble) {
-    return static_cast<int64_t>(double_);
-  } else {
-    assert(false);
-  }
-}
-
-double Value::AsDouble() const {
-  if (type_ == Type::kInteger) {
-    return static_cast<double>(integer_);
-  } else if (type_ == Type::kDouble) {
-    return double_;
-  } else {
-    assert(false);
-  }
-}
-
-bool Value::AsBool() const {
-  assert(type_ == Type::kBool);
-  return bool_;
-}
-
-std::string Value::AsString() const {
-  assert(type_ == Type::kString);
-  return string_;
-}
-
-Object Value::AsObject() const {
-  assert(type_ == Type::kObject);
-  return object_;
-}
-
-Array Value::AsArray() const {
-  assert(type_ == Type::kArray);
-  return array_;
-}
-
-const int64_t& Value::GetInteger() const {
-  assert(type_ == Type::kInteger);
-  return integer_;
-}
-
-const double& Value::GetDouble() const {
-  assert(type_ == Type::kDouble);
-  return double_;
-}
-
-const bool& Value::GetBool() const {
-  assert(type_ == Type::kBool);
-  return bool_;
-}
-
-const std::string& Value::GetString() const {
-  assert(type_ == Type::kString);
-  return string_;
-}
-
-const Object& Value::GetObject() const {
-  assert(type_ == Type::kObject);
-  return object_;
-}
-
-const Array& Value::GetArray() const {
-  assert(type_ == Type::kArray);
-  return array_;
-}
-
-Value& Value::operator[](size_t i) {
-  assert(type_ == Type::kArray);
-  assert(i < array_.Size());
-  return array_[i];
-}
-
-const Value& Value::operator[](size_t i) const {
-  assert(type_ == Type::kArray);
-  assert(i < array_.Size());
-  return array_[i];
-}
-
-Value& Value::operator[](const std::string& key) {
-  assert(type_ == Type::kObject);
-  return object_[key];
-}
-
-Value& Value::operator[](std::string&& key) {
-  assert(type_ == Type::kObject);
-  return object_[std::move(key)];
-}
-  
-bool operator==(const Object& left, const Object& right) {
-  return left.value_ == right.value_;
-}
-
-bool operator!=(const Object& left, const Object& right) {
-  return !(left.value_ == right.value_);
-}
-
-bool operator>(const Object& left, const Object& right) {
-  return left.value_ > right.value_;
-}
-
-bool operator<(const Object& left, const Object& right) {
-  return left.value_ < right.value_;
-}
-
-bool operator>=(const Object& left, const Object& right) {
-  return !(left.value_ < right.value_);
-}
-
-bool operator<=(const Object& left, const Object& right) {
-  return !(left.value_ > right.value_);
-}
-
-bool operator==(const Array& left, const Array& right) {
-  return left.value_ == right.value_;
-}
-
-bool operator!=(const Array& left, const Array& right) {
-  return !(left == right);
-}
-
-bool operator>(const Array& left, const Array& right) {
-  return left > right;
-}
-
-bool operator<(const Array& left, const Array& right) {
-  return left < right;
-}
-
-bool operator>=(const Array& left, const Array& right) {
-  return !(left < right);
-}
-
-bool operator<=(const Array& left, const Array& right) {
-  return !(left > right);
-}
-
-bool operator==(const Value& left, const Value& right) {
-  if (left.type_ != right.type_ && (!left.IsNumeric() || !right.IsNumeric()))
-    return false;
-
-  switch (left.type_) {
-  case Value::Type::kBool:
-    return left.bool_ == right.bool_;
-  case Value::Type::kInteger:
-    if (right.type_ == Value::Type::kDouble) {
-      return (static_cast<double>(left.integer_) - right.double_) < 1e-8;
-    } else if (right.type_ == Value::Type::kInteger) {
-      return left.integer_ == right.integer_;
-    } else {
-      return false;
-    }
-  case Value::Type::kDouble:
-    if (right.type_ == Value::Type::kDouble) {
-      return (left.double_ - right.double_) < 1e-8;
-    } else if (right.type_ == Value::Type::kInteger) {
-      return (left.double_ - static_cast<double>(right.integer_)) < 1e-8;
-    } else {
-      return false;
-    }
-  case Value::Type::kString:
-    return left.string_ == right.string_;
-  case Value::Type::kObject:
-    return left.object_ == right.object_;
-  case Value::Type::kArray:
-    return left.array_ == right.array_;
-  default: // NullT or DummyT
-    return true;
-  }
-}
-
-bool operator!=(const Value& left, const Value& right) {
-  return !(left == right);
-}
-
-bool operator<(const Value& left, const Value& right) {
-  if (left.IsIntegral() && right.IsIntegral()) {
-    return left.integer_ < right.integer_;
-  } else if (left.IsIntegral() && right.IsDouble()) {
-    return static_cast<double>(left.integer_) < right.double_;
-  } else if (left.IsDouble() && right.IsIntegral()) {
-    return left.double_ < static_cast<double>(right.integer_);
-  } else if (left.IsDouble() && right.IsDouble()) {
-    return left.double_ < right.double_;
-  } else if (left.IsString() && right.IsString()) {
-    return left.string_ < right.string_;
-  } else if (left.IsObject() && right.IsObject()) {
-    return left.object_ < right.object_;
-  } else if (left.IsArray() && right.IsArray()) {
-    return left.array_ < right.array_;
-  } else {
-    assert(false);
+template class BasicObject<std::allocator<char> >;
+template class BasicArray<std::allocator<char> >;
+template class BasicValue<std::allocator<char> >;
+
+static_assert(sizeof(Value) <= 16, "a Value must fit in 16 bytes");
+
+// random_device may have no source of entropy and throw, the time and
+// an address on the stack, moved by ASLR, are mixed in anyway
+static uint64_t DrawHashSeed() {
+  uint64_t result = static_cast<uint64_t>(
+      std::chrono::high_resolution_clock::now().time_since_epoch().count());
+  result ^= reinterpret_cast<uintptr_t>(&result) * 0x9E3779B97F4A7C15ULL;
+  try {
+    std::random_device device;
+    result ^= (static_cast<uint64_t>(device()) << 32) | device();
+  } catch (const std::exception&) {
   }
-  return false;
-}
-
-bool operator>(const Value& left, const Value& right) {
-  return right < left;
-}
-
-bool operator<=(const Value& left, const Value& right) {
-  return !(left > right);
+  return result;
 }
 
-bool operator>=(const Value& left, const Value& right) {
-  return !(left < right);
+uint64_t GetHashSeed() {
+  static const uint64_t seed = DrawHashSeed();
+  return seed;
 }
 
 /**
@@ -1015,9 +145,53 @@ static int32_t Utf82CodePoint(const char*& utf8_str) {
   return -1;
 }
 
-bool Parser::Deserialize(const std::string& csonpp_str, Value& value) {
-  ParserImpl impl;
-  return impl.Deserialize(csonpp_str, value);
+Parser::Parser(size_t max_depth)
+    : impl_(std::make_shared<ParserImpl>(max_depth)) {
+}
+
+Parser::~Parser() {
+}
+
+bool Parser::Load(const char* csonpp_str, size_t size, Value& value) {
+  return impl_->Deserialize(csonpp_str, size, value);
+}
+
+bool Parser::LoadInSitu(char* csonpp_str, size_t size, Value& value) {
+  return impl_->DeserializeInSitu(csonpp_str, size, value);
+}
+
+bool Parser::Load(const char* csonpp_str, size_t size, Document& document) {
+  return impl_->Deserialize(csonpp_str, size, document);
+}
+
+bool Parser::Deserialize(const std::string& csonpp_str, 
+                         Value& value, 
+                         size_t max_depth) {
+  return Deserialize(csonpp_str.data(), csonpp_str.size(), value, max_depth);
+}
+
+bool Parser::Deserialize(const char* csonpp_str, 
+                         size_t size, 
+                         Value& value, 
+                         size_t max_depth) {
+  ParserImpl impl(max_depth);
+  return impl.Deserialize(csonpp_str, size, value);
+}
+
+bool Parser::Deserialize(const char* csonpp_str, 
+                         size_t size, 
+                         Document& document, 
+                         size_t max_depth) {
+  ParserImpl impl(max_depth);
+  return impl.Deserialize(csonpp_str, size, document);
+}
+
+bool Parser::DeserializeInSitu(char* csonpp_str, 
+                               size_t size, 
+                               Value& value, 
+                               size_t max_depth) {
+  ParserImpl impl(max_depth);
+  return impl.DeserializeInSitu(csonpp_str, size, value);
 }
 
 void Parser::Serialize(const Value& value, std::string& csonpp_str) {
@@ -1025,276 +199,104 @@ void Parser::Serialize(const Value& value, std::string& csonpp_str) {
   impl.Serialize(value, csonpp_str);
 }
 
-Token TokenizerImpl::GetToken() {
-  /**
-   * The DFA
-   * kStart + 'n'(ull)   -> END (null)
-   * kStart + 'f'(alse)  -> END (false)
-   * kStart + 't'(rue)   -> END (true)
-   * kStart + ':'        -> END (:)
-   * kStart + ','        -> END (,)
-   * kStart + '['        -> END ([)
-   * kStart + ']'        -> END (])
-   * kStart + '{'        -> END ({)
-   * kStart + '}'        -> END (})
-   * kStart + '\"'       -> STRING
-   * kStart + '-'        -> kNumber1
-   * kStart + '[1-9]'    -> kNumber2
-   * STRING + '[^"]'    -> STRING
-   * STRING + '\"'      -> DONE (String)
-   * kNumber1 + '[1-9]' -> kNumber2
-   * kNumber1 + '0'     -> kNumber3
-   * kNumber2 + '[0-9]' -> kNumber2
-   * kNumber2 + '.'     -> kNumber4
-   * kNumber2 + '[eE]'  -> kNumber5
-   * kNumber2 + '[,}\]]'-> DONE (Integer)
-   * kNumber3 + '.'     -> kNumber4
-   * kNumber3 + '[,}\]]'-> DONE (Integer)
-   * kNumber4 + '[0-9]' -> kNumber4
-   * kNumber4 + '[eE]'  -> kNumber5
-   * kNumber4 + '[,}\]]'-> DONE (Double)
-   * kNumber5 + '[+-]'  -> kNumber6
-   * kNumber5 + '[0-9]' -> kNumber7
-   * kNumber6 + '[0-9]' -> kNumber7
-   * kNumber7 + '[0-9]' -> kNumber7
-   * kNumber7 + '[,}\]]'-> DONE (Double)
-   */
-  enum class DFAState {
-    kStart, 
-    kString, 
-    kNumber1, 
-    kNumber2, 
-    kNumber3, 
-    kNumber4, 
-    kNumber5, 
-    kNumber6, 
-    kNumber7, 
-  };
+namespace detail {
 
-  Token token;
-  DFAState state = DFAState::kStart;
+// the positions stage 1 finds at a time, small enough to stay in the cache
+static const size_t kIndexCapacity = 1024;
 
-  auto error_occured = [&token] {
-    token.value_ = "";
-    token.type_ = Token::Type::kDummy;
-    return token;
-  };
+bool Tokenizer::UseIndex() {
+  assert(last_ && cur_pos_ == 0 && pending_ == Pending::kNone);
+  if (size_ >= UINT32_MAX)
+    return false;
+  indexed_ = true;
+  index_state_ = IndexState();
+  next_ = 0;
+  if (insitu_str_) {
+    BuildStructuralIndex(csonpp_str_, size_, index_);
+    index_size_ = index_.size();
+    index_state_.base = size_;
+  } else {
+    index_.resize(kIndexCapacity);
+    index_size_ = 0;
+  }
+  return true;
+}
+
+bool Tokenizer::RefillIndex() {
+  next_ = 0;
+  index_size_ = IndexBlocks(csonpp_str_, size_, index_state_, 
+                            index_.data(), index_.size());
+  return index_size_ != 0;
+}
 
+/**
+ * same as GetString(), but the string is decoded over its own escaped text,
+ * which is never shorter, and terminated by a '\0' that at most takes the
+ * place of the closing '"'. the input is whole.
+ */
+Token Tokenizer::GetStringInSitu() {
+  char* begin = insitu_str_ + cur_pos_;
+  char* dest = begin;
   while (true) {
+    const char* run = csonpp_str_ + std::min(cur_pos_, size_);
+    const char* run_end = FindStringSpecial(run, csonpp_str_ + size_);
+    if (dest != run)
+      memmove(dest, run, run_end - run);
+    dest += run_end - run;
+    cur_pos_ += run_end - run;
+
     int c = GetNextChar();
-    switch (state) {
-    case DFAState::kStart:
-      while (isspace(c)) {
-        c = GetNextChar();
-      }
-      switch (c) {
-      case ',':
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kComma;
-        return token;
-      case ':':
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kColon;
-        return token;
-      case '{':
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kLeftBrace;
-        return token;
-      case '}':
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kRightBrace;
-        return token;
-      case '[':
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kLeftBracket;
-        return token;
-      case ']':
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kRightBracket;
-        return token;
-      case 't':
-        if (GetNextChar() == 'r' && 
-            GetNextChar() == 'u' && 
-            GetNextChar() == 'e') {
-          token.value_.append("true");
-          token.type_ = Token::Type::kTrue;
-          return token;
-        } else {
-          return error_occured();
-        }
-      case 'f':
-        if (GetNextChar() == 'a' && 
-            GetNextChar() == 'l' && 
-            GetNextChar() == 's' && 
-            GetNextChar() == 'e') {
-          token.value_.append("false");
-          token.type_ = Token::Type::kFalse;
-          return token;
-        } else {
-          return error_occured();
-        }
-      case 'n':
-        if (GetNextChar() == 'u' && 
-            GetNextChar() == 'l' && 
-            GetNextChar() == 'l') {
-          token.value_.append("null");
-          token.type_ = Token::Type::kNull;
-          return token;
-        } else {
-          return error_occured();
-        }
-      case '\"':
-        state = DFAState::kString;
-        token.type_ = Token::Type::kString;
-        break;
-      case '-':
-        state = DFAState::kNumber1;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kInteger;
-        break;
-      case '0':
-        state = DFAState::kNumber3;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kInteger;
-        break;
-      case '1': case '2': case '3': case '4':
-      case '5': case '6': case '7': case '8': case '9':
-        state = DFAState::kNumber2;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kInteger;
-        break;
-      default:
-        return error_occured();
-      }
-      break;
-    case DFAState::kString:
-      switch (c) {
-      case '\"': return token;
-      case '\\': {
-        int cc = GetNextChar();
-        switch (cc) {
-        case '\"': token.value_.append(1, '\"'); break;
-        case '\\': token.value_.append(1, '\\'); break;
-        case 'r':  token.value_.append(1, '\r'); break;
-        case 'n':  token.value_.append(1, '\n'); break;
-        case 't':  token.value_.append(1, '\t'); break;
-        case 'b':  token.value_.append(1, '\b'); break;
-        case 'f':  token.value_.append(1, '\f'); break;
-        case 'u': {
-          // convert unicode escapse charactor
-          char32_t code_point = DecodeUnicode();
-          if (code_point == 0)
-            return error_occured();
-          token.value_ += CodePoint2Utf8(code_point);
-          break;
-        }
-        default: return error_occured();
-        }
-        break;
-      }
-      case '\0': return error_occured();
-      default: token.value_.append(1, static_cast<char>(c)); break;
-      }
-      break;
-    case DFAState::kNumber1:
-      if (c == '0') {
-        state = DFAState::kNumber3;
-        token.value_.append(1, static_cast<char>(c));
-      } else if (c >= '1' && c <= '9') {
-        state = DFAState::kNumber2;
-        token.value_.append(1, static_cast<char>(c));
-      } else {
-        return error_occured();
-      }
-      break;
-    case DFAState::kNumber2:
-      while (isdigit(c)) {
-        token.value_.append(1, static_cast<char>(c));
-        c = GetNextChar();
-      }
-      if (c == '\0' || c == ',' || c == '}' || c == ']') {
-        UngetNextChar();
-        return token;
-      } else if (c == 'e' || c == 'E') {
-        state = DFAState::kNumber5;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kDouble;
-      } else if (c == '.') {
-        state = DFAState::kNumber4;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kDouble;
-      } else {
-        return error_occured();
-      }
-      break;
-    case DFAState::kNumber3:
-      if (c == '\0' || c == ',' || c == '}' || c == ']') {
-        UngetNextChar();
-        return token;
-      } else if (c == 'e' || c == 'E') {
-        state = DFAState::kNumber5;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kDouble;
-      } else if (c == '.') {
-        state = DFAState::kNumber4;
-        token.value_.append(1, static_cast<char>(c));
-        token.type_ = Token::Type::kDouble;
-      } else {
-        return error_occured();
-      }
-      break;
-    case DFAState::kNumber4:
-      while (isdigit(c)) {
-        token.value_.append(1, static_cast<char>(c));
-        c = GetNextChar();
-      }
-      if (c == '\0' || c == ',' || c == '}' || c == ']') {
-        UngetNextChar();
-        return token;
-      } else if (c == 'e' || c == 'E') {
-        token.value_.append(1, static_cast<char>(c));
-        state = DFAState::kNumber5;
-      } else {
-        return error_occured();
-      }
-      break;
-    case DFAState::kNumber5:
-      if (isdigit(c)) {
-        token.value_.append(1, static_cast<char>(c));
-        state = DFAState::kNumber7;
-      } else if (c == '+' || c == '-') {
-        token.value_.append(1, static_cast<char>(c));
-        state = DFAState::kNumber6;
-      } else {
-        return error_occured();
-      }
-      break;
-    case DFAState::kNumber6:
-      if (isdigit(c)) {
-        token.value_.append(1, static_cast<char>(c));
-        state = DFAState::kNumber7;
-      } else {
-        return error_occured();
-      }
-      break;
-    case DFAState::kNumber7:
-      while (isdigit(c)) {
-        token.value_.append(1, static_cast<char>(c));
-        c = GetNextChar();
-      }
-      if (c == '\0' || c == ',' || c == '}' || c == ']') {
-        UngetNextChar();
-        return token;
-      } else {
-        return error_occured();
-      }
+    switch (c) {
+    case '\"': {
+      *dest = '\0';
+      Token token;
+      token.type_ = Token::Type::kString;
+      token.text_ = begin;
+      token.text_size_ = dest - begin;
+      return token;
+    }
+    case '\\': {
+      size_t length = DecodeEscape(dest);
+      if (!length)
+        return Error();
+      dest += length;
       break;
     }
+    case '\0': return Error();
+    default: *dest++ = static_cast<char>(c); break;
+    }
+  }
+}
+
+/**
+ * decode the escape sequence after a '\\'
+ * @param decoded  receives the utf-8 bytes, at most 4
+ * @return the number of bytes, 0 if the escape is invalid
+ */
+size_t Tokenizer::DecodeEscape(char* decoded) {
+  switch (GetNextChar()) {
+  case '\"': *decoded = '\"'; return 1;
+  case '\\': *decoded = '\\'; return 1;
+  case '/':  *decoded = '/'; return 1;
+  case 'r':  *decoded = '\r'; return 1;
+  case 'n':  *decoded = '\n'; return 1;
+  case 't':  *decoded = '\t'; return 1;
+  case 'b':  *decoded = '\b'; return 1;
+  case 'f':  *decoded = '\f'; return 1;
+  case 'u': {
+    // convert unicode escapse charactor
+    char32_t code_point = DecodeUnicode();
+    if (code_point == 0)
+      return 0;
+    std::string utf8 = CodePoint2Utf8(code_point);
+    memcpy(decoded, utf8.data(), utf8.size());
+    return utf8.size();
+  }
+  default: return 0;
   }
-  return error_occured();
 }
 
-int32_t TokenizerImpl::DecodeUnicode() {
+int32_t Tokenizer::DecodeUnicode() {
   auto hex_char_2_int = [] (char ch) -> int {
     if (ch >= '0' && ch <= '9') return ch - '0';
     else if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
@@ -1338,283 +340,497 @@ int32_t TokenizerImpl::DecodeUnicode() {
   return code_point1;
 }
 
+}  // namespace detail
+
 void ParserImpl::Serialize(const Value& value, 
                            std::string& csonpp_str) const {
-  switch (value.GetType()) {
-  case Value::Type::kNull:
-    csonpp_str = "null";
-    break;
-  case Value::Type::kBool:
-    csonpp_str = value.AsBool() ? "true" : "false";
-    break;
-  case Value::Type::kInteger:
-    csonpp_str = Number2Str<int64_t>(value.GetInteger());
-    break;
-  case Value::Type::kDouble:
-    csonpp_str = Number2Str<double>(value.GetDouble());
-    break;
-  case Value::Type::kString:
-    csonpp_str.append(SerializeString(value.GetString()));
-    break;
-  case Value::Type::kObject:
-    csonpp_str = SerializeObject(value);
-    break;
-  case Value::Type::kArray:
-    csonpp_str = SerializeArray(value);
-    break;
-  default:
-    csonpp_str = "";
-    break;
-  }
+  csonpp_str.clear();
+  SerializeValue(value, csonpp_str);
 }
 
-std::string ParserImpl::SerializeObject(const Value& value) const {
-  std::string result("{");
-  const auto& object = value.GetObject();
-  int size = value.Size();
-  auto cur = 0;
-  for (auto const_itr = object.Begin(); 
-       const_itr != object.End(); 
-       ++const_itr, ++cur) {
-    result.append(SerializeString(const_itr->first));
-    result.append(1, ':');
-    std::string sub_str;
-    Serialize(const_itr->second, sub_str);
-    result.append(sub_str);
-    if (cur != size - 1)
-      result.append(1, ',');
+/**
+ * the value is written in one loop instead of recursing once per level:
+ * the objects and arrays being written are kept in frames along with the
+ * index of their next member or element, so that the call stack stays flat
+ * however deep the value is.
+ */
+void ParserImpl::SerializeValue(const Value& value, 
+                                std::string& csonpp_str) const {
+  struct Frame {
+    const Value* container;
+    size_t next;
+  };
+  std::vector<Frame> frames;
+  const Value* cur = &value;
+  while (cur) {
+    switch (cur->GetType()) {
+    case Value::Type::kNull:
+      csonpp_str.append("null");
+      break;
+    case Value::Type::kBool:
+      csonpp_str.append(cur->AsBool() ? "true" : "false");
+      break;
+    case Value::Type::kInteger:
+      SerializeInteger(cur->GetInteger(), csonpp_str);
+      break;
+    case Value::Type::kDouble:
+      SerializeDouble(cur->GetDouble(), csonpp_str);
+      break;
+    case Value::Type::kString:
+      SerializeString(cur->GetStringData(), cur->GetStringSize(), csonpp_str);
+      break;
+    case Value::Type::kObject:
+      csonpp_str.append(1, '{');
+      frames.push_back(Frame{cur, 0});
+      break;
+    case Value::Type::kArray:
+      csonpp_str.append(1, '[');
+      frames.push_back(Frame{cur, 0});
+      break;
+    default:
+      break;
+    }
+
+    // the next value to write, the containers done with are closed
+    cur = nullptr;
+    while (!cur && !frames.empty()) {
+      Frame& frame = frames.back();
+      if (frame.container->GetType() == Value::Type::kObject) {
+        const auto& object = frame.container->GetObject();
+        if (frame.next < object.Size()) {
+          if (frame.next)
+            csonpp_str.append(1, ',');
+          auto const_itr = object.Begin() + frame.next++;
+          SerializeString(const_itr->first.c_str(), const_itr->first.size(), csonpp_str);
+          csonpp_str.append(1, ':');
+          cur = &const_itr->second;
+        } else {
+          csonpp_str.append(1, '}');
+          frames.pop_back();
+        }
+      } else {
+        const auto& array = frame.container->GetArray();
+        if (frame.next < array.Size()) {
+          if (frame.next)
+            csonpp_str.append(1, ',');
+          cur = &array[frame.next++];
+        } else {
+          csonpp_str.append(1, ']');
+          frames.pop_back();
+        }
+      }
+    }
   }
-  result.append(1, '}');
-  return result;
 }
 
-std::string ParserImpl::SerializeArray(const Value& value) const {
-  std::string result("[");
-  const auto& array = value.AsArray();
-  int size = array.Size();
-  for (auto i = 0; i < size; ++i) {
-    std::string sub_str;
-    Serialize(array[i], sub_str);
-    result.append(sub_str);
-    if (i != size - 1)
-      result.append(1, ',');
-  }
-  result.append(1, ']');
-  return result;
+// the digits are written straight into csonpp_str
+void ParserImpl::SerializeInteger(int64_t num, std::string& csonpp_str) {
+  size_t size = csonpp_str.size();
+  csonpp_str.resize(size + kMaxInt64Length);
+  char* end = FormatInt64(num, &csonpp_str[size]);
+  csonpp_str.resize(end - csonpp_str.data());
 }
 
-std::string ParserImpl::SerializeString(const std::string& utf8_str) const {
+// the digits are written straight into csonpp_str
+void ParserImpl::SerializeDouble(double num, std::string& csonpp_str) {
+  size_t size = csonpp_str.size();
+  csonpp_str.resize(size + kMaxDoubleLength);
+  char* end = FormatDouble(num, &csonpp_str[size]);
+  csonpp_str.resize(end - csonpp_str.data());
+}
+
+void ParserImpl::SerializeString(const char* utf8_str, 
+                                 size_t size, 
+                                 std::string& csonpp_str) {
   auto int_2_hex_char = [] (int integer) -> char {
     if (integer >= 0 && integer < 10) return integer + '0';
     else if (integer >= 10 && integer < 16) return integer - 10 + 'A';
     return 0;                                                                   
   };
 
-  std::string result("\"");
-  result.reserve(utf8_str.size() * 2);
-  const char* ch = utf8_str.c_str();
+  size_t start = csonpp_str.size();
+  csonpp_str.reserve(start + size * 2);
+  csonpp_str.append(1, '\"');
+  const char* ch = utf8_str;
   while (*ch) {
     int32_t code_point = Utf82CodePoint(ch);
     if (code_point < 0) {
-      result.clear();
-      return result;
+      csonpp_str.resize(start);
+      return;
     }
 
     if (code_point > 0x7F) {
       if (code_point <= 0xFFFF) { // in Basic Multilingual Plane
-        result.append("\\u");
-        result.append(1, int_2_hex_char(code_point >> 12));
-        result.append(1, int_2_hex_char((code_point >> 8) & 0xF));
-        result.append(1, int_2_hex_char((code_point >> 4) & 0xF));
-        result.append(1, int_2_hex_char(code_point & 0xF));
+        csonpp_str.append("\\u");
+        csonpp_str.append(1, int_2_hex_char(code_point >> 12));
+        csonpp_str.append(1, int_2_hex_char((code_point >> 8) & 0xF));
+        csonpp_str.append(1, int_2_hex_char((code_point >> 4) & 0xF));
+        csonpp_str.append(1, int_2_hex_char(code_point & 0xF));
       } else { // in Supplementary Planes
         code_point -= 0x10000;
         assert(code_point <= 0xFFFFF);
         int32_t lead_surrogate = 0xD800 + ((code_point >> 10) & 0x3FF);
         int32_t trail_surrogate = 0xDC00 + (code_point & 0x3FF);
-        result.append("\\u");
-        result.append(1, int_2_hex_char(lead_surrogate >> 12));
-        result.append(1, int_2_hex_char((lead_surrogate >> 8) & 0xF));
-        result.append(1, int_2_hex_char((lead_surrogate >> 4) & 0xF));
-        result.append(1, int_2_hex_char(lead_surrogate & 0xF));
-        result.append("\\u");
-        result.append(1, int_2_hex_char(trail_surrogate >> 12));
-        result.append(1, int_2_hex_char((trail_surrogate >> 8) & 0xF));
-        result.append(1, int_2_hex_char((trail_surrogate >> 4) & 0xF));
-        result.append(1, int_2_hex_char(trail_surrogate & 0xF));
+        csonpp_str.append("\\u");
+        csonpp_str.append(1, int_2_hex_char(lead_surrogate >> 12));
+        csonpp_str.append(1, int_2_hex_char((lead_surrogate >> 8) & 0xF));
+        csonpp_str.append(1, int_2_hex_char((lead_surrogate >> 4) & 0xF));
+        csonpp_str.append(1, int_2_hex_char(lead_surrogate & 0xF));
+        csonpp_str.append("\\u");
+        csonpp_str.append(1, int_2_hex_char(trail_surrogate >> 12));
+        csonpp_str.append(1, int_2_hex_char((trail_surrogate >> 8) & 0xF));
+        csonpp_str.append(1, int_2_hex_char((trail_surrogate >> 4) & 0xF));
+        csonpp_str.append(1, int_2_hex_char(trail_surrogate & 0xF));
       }
     } else if (code_point <= 0x1F) { // control charactor
       switch (code_point) {
-      case '\b': result.append("\\b"); break;
-      case '\f': result.append("\\f"); break;
-      case '\n': result.append("\\n"); break;
-      case '\r': result.append("\\r"); break;
-      case '\t': result.append("\\t"); break;
+      case '\b': csonpp_str.append("\\b"); break;
+      case '\f': csonpp_str.append("\\f"); break;
+      case '\n': csonpp_str.append("\\n"); break;
+      case '\r': csonpp_str.append("\\r"); break;
+      case '\t': csonpp_str.append("\\t"); break;
       default:
-        result.append("\\u00");
-        result.append(1, int_2_hex_char((code_point >> 4) & 0xf));
-        result.append(1, int_2_hex_char(code_point & 0xf));
+        csonpp_str.append("\\u00");
+        csonpp_str.append(1, int_2_hex_char((code_point >> 4) & 0xf));
+        csonpp_str.append(1, int_2_hex_char(code_point & 0xf));
         break;
       }
     } else if (code_point == '\\' || code_point == '\"') {
-      result.append(1, '\\');
-      result.append(1, code_point);
+      csonpp_str.append(1, '\\');
+      csonpp_str.append(1, code_point);
     } else {
-      result.append(1, code_point);
+      csonpp_str.append(1, code_point);
     }
   }
-  result.append(1, '\"');
-  return result;
+  csonpp_str.append(1, '\"');
+}
+
+bool ParserImpl::Deserialize(const char* csonpp_str, 
+                             size_t size, 
+                             Value& value) {
+  core_.Reset(csonpp_str, size);
+  core_.GetTokenizer().UseIndex();
+  return ParseDocument(value, false);
 }
 
-bool ParserImpl::Deserialize(const std::string& csonpp_str, Value& value) {
-  tokenizer_ = std::make_shared<TokenizerImpl>(&csonpp_str);
+bool ParserImpl::Deserialize(const char* csonpp_str, 
+                             size_t size, 
+                             Document& document) {
+  document.Clear();
+  arena_ = &document.GetArena();
+  bool ok = Deserialize(csonpp_str, size, document.root_);
+  arena_ = nullptr;
+  return ok;
+}
 
-  auto error_occured = [&value, this] {
-    value = Value();
-    tokenizer_->Reset();
-    return false;
-  };
+bool ParserImpl::DeserializeInSitu(char* csonpp_str, 
+                                   size_t size, 
+                                   Value& value) {
+  core_.Reset(csonpp_str, size);
+  core_.GetTokenizer().SetInSitu(csonpp_str);
+  core_.GetTokenizer().UseIndex();
+  return ParseDocument(value, true);
+}
+
+/**
+ * the document is parsed by the same loop as Parser::Parse(), with a
+ * DocumentBuilder as the handler: the open objects and arrays are kept on
+ * explicit stacks, so the call stack stays flat however long or deep the
+ * input is.
+ */
+bool ParserImpl::ParseDocument(Value& value, bool insitu) {
+  builder_.Reset(value, arena_);
+  detail::ParserCore::Status status;
+  if (insitu) {
+    do {
+      status = core_.NextInSitu(builder_);
+    } while (status == detail::ParserCore::Status::kPart);
+  } else {
+    do {
+      status = core_.Next(builder_);
+    } while (status == detail::ParserCore::Status::kPart);
+  }
+  if (status == detail::ParserCore::Status::kEnd)
+    return true;
+  value = Value();
+  core_.Reset(nullptr, 0);
+  return false;
+}
+
+Reader::Reader(const char* csonpp_str, size_t size, size_t max_depth)
+    : impl_(std::make_shared<ReaderImpl>(csonpp_str, size, max_depth)) {
+}
+
+Reader::~Reader() {
+}
+
+Reader::Event Reader::Next() {
+  return impl_->Next();
+}
+
+bool Reader::GetBool() const {
+  return impl_->GetBool();
+}
+
+int64_t Reader::GetInteger() const {
+  return impl_->GetInteger();
+}
+
+double Reader::GetDouble() const {
+  return impl_->GetDouble();
+}
 
-  if (csonpp_str.empty())
-    return error_occured();
+const std::string& Reader::GetString() const {
+  return impl_->GetString();
+}
 
-  if (!ParseValue(value))
-    return error_occured();
+bool Writer::Null() {
+  Separate();
+  csonpp_str_.append("null");
+  separate_ = true;
   return true;
 }
 
-bool ParserImpl::ParseValue(Value& value) {
-  auto error_occured = [&value] {
-    value = Value();
-    return false;
-  };
+bool Writer::Bool(bool value) {
+  Separate();
+  csonpp_str_.append(value ? "true" : "false");
+  separate_ = true;
+  return true;
+}
 
-  Token token = tokenizer_->GetToken();
-  switch (token.type_) {
-  case Token::Type::kLeftBrace:
-    return ParseObject(value);
-  case Token::Type::kLeftBracket:
-    return ParseArray(value);
-  case Token::Type::kString:
-    value = Value(token.value_);
-    return true;
-  case Token::Type::kInteger: {
-    bool valid = false;
-    int64_t integer = Str2Number<int64_t>(token.value_, &valid);
-    if (!valid)
-      return error_occured();
-    value = Value(integer);
-    return true;
-  }
-  case Token::Type::kDouble: {
-    bool valid = false;
-    double num = Str2Number<double>(token.value_, &valid);
-    if (!valid)
-      return error_occured();
-    value = Value(num);
-    return true;
-  }
-  case Token::Type::kTrue:
-    value = Value(true);
-    return true;
-  case Token::Type::kFalse:
-    value = Value(false);
-    return true;
-  case Token::Type::kNull:
-    value = Value(nullptr);
-    return true;
-  default:
-    return error_occured();
-  }
+bool Writer::Int64(int64_t value) {
+  Separate();
+  ParserImpl::SerializeInteger(value, csonpp_str_);
+  separate_ = true;
+  return true;
 }
 
-bool ParserImpl::ParseObject(Value& value) {
-  auto error_occured = [&value] {
-    value = Value();
-    return false;
-  };
-  value = Value(Value::Type::kObject);
-  if (!ParseMembers(value)) {
-    tokenizer_->UngetNextChar();
-    auto token = tokenizer_->GetToken();
-    if (token.type_ != Token::Type::kRightBrace)
-      return error_occured();
-    value = Value(Value::Type::kObject);
-  }
+bool Writer::Double(double value) {
+  Separate();
+  ParserImpl::SerializeDouble(value, csonpp_str_);
+  separate_ = true;
   return true;
 }
 
-bool ParserImpl::ParseMembers(Value& value) {
-  auto error_occured = [&value] {
-    value = Value();
-    return false;
-  };
-  if (!ParsePair(value))
-    return error_occured();
-  auto token = tokenizer_->GetToken();
-  if (token.type_ == Token::Type::kComma) {
-    return ParseMembers(value);
-  } else if (token.type_ == Token::Type::kRightBrace) {
-    return true;
-  } else {
-    return error_occured();
-  }
+bool Writer::String(const char* str, size_t size) {
+  Separate();
+  ParserImpl::SerializeString(str, size, csonpp_str_);
+  separate_ = true;
+  return true;
 }
 
-bool ParserImpl::ParsePair(Value& value) {
-  auto error_occured = [&value] {
-    value = Value();
-    return false;
-  };
-  auto token = tokenizer_->GetToken();
-  if (token.type_ != Token::Type::kString)
-    return error_occured();
-
-  auto next_token = tokenizer_->GetToken();
-  if (next_token.type_ != Token::Type::kColon)
-    return error_occured();
-
-  Value sub_value;
-  if (!ParseValue(sub_value))
-    return error_occured();
-  value[token.value_] = sub_value;
+bool Writer::StartObject() {
+  Separate();
+  csonpp_str_.append(1, '{');
+  separate_ = false;
+  return true;
+}
+
+bool Writer::Key(const char* key, size_t size) {
+  Separate();
+  ParserImpl::SerializeString(key, size, csonpp_str_);
+  csonpp_str_.append(1, ':');
+  separate_ = false;
+  return true;
+}
+
+bool Writer::EndObject() {
+  csonpp_str_.append(1, '}');
+  separate_ = true;
+  return true;
+}
+
+bool Writer::StartArray() {
+  Separate();
+  csonpp_str_.append(1, '[');
+  separate_ = false;
   return true;
 }
 
-bool ParserImpl::ParseArray(Value& value) {
-  auto error_occured = [&value] {
-    value = Value();
+bool Writer::EndArray() {
+  csonpp_str_.append(1, ']');
+  separate_ = true;
+  return true;
+}
+
+ReaderImpl::ReaderImpl(const char* csonpp_str, size_t size, size_t max_depth)
+    : core_(max_depth),
+      window_end_(0),
+      source_end_(true) {
+  core_.Reset(csonpp_str, size);
+}
+
+ReaderImpl::ReaderImpl(std::unique_ptr<InputSource> source, 
+                       size_t max_depth, 
+                       size_t buffer_size)
+    : core_(max_depth),
+      source_(std::move(source)),
+      window_(std::max<size_t>(buffer_size, 1)),
+      window_end_(0),
+      source_end_(false) {
+  core_.Reset(window_.data(), 0, false);
+}
+
+// the window is refilled whenever the tokenizer is out of input
+Reader::Event ReaderImpl::Next() {
+  while (true) {
+    switch (core_.Next(recorder_)) {
+    case detail::ParserCore::Status::kPart:
+      return recorder_.event_;
+    case detail::ParserCore::Status::kEnd:
+      return Reader::Event::kEnd;
+    case detail::ParserCore::Status::kMore:
+      FillWindow();
+      break;
+    default:
+      return Reader::Event::kError;
+    }
+  }
+}
+
+/**
+ * the bytes the tokenizer still needs are moved to the front of the window
+ * and the rest of it is read from the source. the window only grows when
+ * a single token fills it. the tokenizer goes on from where it stopped.
+ */
+void ReaderImpl::FillWindow() {
+  size_t keep = core_.GetTokenizer().GetKeepPosition();
+  window_end_ -= keep;
+  memmove(window_.data(), window_.data() + keep, window_end_);
+  if (window_end_ == window_.size())
+    window_.resize(window_.size() * 2);
+  size_t read = source_->Read(window_.data() + window_end_, 
+                              window_.size() - window_end_);
+  if (!read)
+    source_end_ = true;
+  window_end_ += read;
+  core_.Continue(window_.data(), window_end_, source_end_);
+}
+
+DocumentStream::DocumentStream(const char* csonpp_str, 
+                               size_t size, 
+                               size_t max_depth)
+    : parser_(std::make_shared<ParserImpl>(max_depth)),
+      begin_(csonpp_str),
+      cur_(csonpp_str),
+      end_(csonpp_str + size),
+      offset_(0),
+      line_(0),
+      next_line_(1) {
+}
+
+DocumentStream::DocumentStream(const std::string& csonpp_str, 
+                               size_t max_depth)
+    : DocumentStream(csonpp_str.data(), csonpp_str.size(), max_depth) {
+}
+
+DocumentStream::~DocumentStream() {
+}
+
+DocumentStream::Status DocumentStream::Next(Value& value) {
+  while (cur_ < end_) {
+    const char* line_end = 
+        static_cast<const char*>(memchr(cur_, '\n', end_ - cur_));
+    if (!line_end)
+      line_end = end_;
+    const char* line = cur_;
+    size_t line_number = next_line_++;
+    cur_ = (line_end == end_) ? end_ : line_end + 1;
+
+    const char* first = line;
+    while (first < line_end && isspace(static_cast<unsigned char>(*first)))
+      ++first;
+    if (first == line_end)
+      continue;
+
+    offset_ = line - begin_;
+    line_ = line_number;
+    if (!parser_->Deserialize(line, line_end - line, value))
+      return Status::kError;
+    return Status::kOk;
+  }
+  return Status::kEnd;
+}
+
+size_t DocumentStream::GetOffset() const {
+  return offset_;
+}
+
+size_t DocumentStream::GetLine() const {
+  return line_;
+}
+
+PushParser::PushParser(size_t max_depth)
+    : impl_(std::make_shared<PushParserImpl>(max_depth)) {
+}
+
+PushParser::~PushParser() {
+}
+
+bool PushParser::Feed(const char* chunk, size_t size) {
+  return impl_->Feed(chunk, size);
+}
+
+bool PushParser::Finish(Value& value) {
+  return impl_->Finish(value);
+}
+
+void PushParser::Reset() {
+  impl_->Reset();
+}
+
+/**
+ * the chunk is parsed as far as it goes by the same loop as Parser::Parse().
+ * the token cut by its end is resumed by the next chunk, only the bytes the
+ * tokenizer still needs are kept, e.g. the start of a number or of an escape.
+ */
+bool PushParserImpl::Feed(const char* chunk, size_t size) {
+  if (failed_)
     return false;
-  };
-  value = Value(Value::Type::kArray);
-  if (!ParseElements(value)) {
-    tokenizer_->UngetNextChar();
-    auto next_token = tokenizer_->GetToken();
-    if (next_token.type_ != Token::Type::kRightBracket)
-      return error_occured();
-    value = Value(Value::Type::kArray);
+  if (buffer_.empty()) {
+    core_.Continue(chunk, size, false);
+    if (!Run())
+      return false;
+    size_t keep = core_.GetTokenizer().GetKeepPosition();
+    buffer_.assign(chunk + keep, size - keep);
+  } else {
+    buffer_.append(chunk, size);
+    core_.Continue(buffer_.data(), buffer_.size(), false);
+    if (!Run())
+      return false;
+    buffer_.erase(0, core_.GetTokenizer().GetKeepPosition());
   }
   return true;
 }
 
-bool ParserImpl::ParseElements(Value& value) {
-  auto error_occured = [&value] {
-    value = Value();
+bool PushParserImpl::Finish(Value& value) {
+  bool ok = false;
+  if (!failed_) {
+    core_.Continue(buffer_.data(), buffer_.size(), true);
+    ok = Run();
+  }
+  value = ok ? std::move(root_) : Value();
+  Reset();
+  return ok;
+}
+
+void PushParserImpl::Reset() {
+  root_ = Value();
+  core_.Reset(nullptr, 0, false);
+  builder_.Reset(root_, nullptr);
+  buffer_.clear();
+  failed_ = false;
+}
+
+bool PushParserImpl::Run() {
+  detail::ParserCore::Status status = core_.Next(builder_);
+  while (status == detail::ParserCore::Status::kPart)
+    status = core_.Next(builder_);
+  if (status == detail::ParserCore::Status::kError) {
+    failed_ = true;
     return false;
-  };
-  Value sub_value;
-  if (!ParseValue(sub_value))
-    return error_occured();
-  value.Append(std::move(sub_value));
-  auto next_token = tokenizer_->GetToken();
-  if (next_token.type_ == Token::Type::kRightBracket) {
-    return true;
-  } else if (next_token.type_ == Token::Type::kComma) {
-    return ParseElements(value);
   }
-  return error_occured();
+  return true;
 }
 
 }  // namespace csonpp
-
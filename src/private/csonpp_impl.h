@@ -2,8 +2,9 @@
 #define CSONPP_CSONPP_IMPL_H_
 
 #include "../csonpp.h"
+#include "number_impl.h"
+#include "simd_impl.h"
 
-#include <cstdio>
 #include <cstring>
 #include <map>
 #include <vector>
@@ -35,453 +36,243 @@
 
 namespace csonpp {
 
-struct Token {
-  enum class Type {
-    kDummy,
-    kLeftBrace,   // {
-    kRightBrace,  // }
-    kLeftBracket, // [
-    kRightBracket,// ]
-    kComma,       // ,
-    kColon,       // :
-    kString,      // "xxx"
-    kInteger,     // integer
-    kDouble,      // -0.99e-5
-    kTrue,        // true
-    kFalse,       // false
-    kNull,        // null
-  };
-
-  std::string value_;
-  Type type_;
-
-  Token() : type_(Type::kDummy) {}
-
-  bool IsOk() {
-    return type_ != Type::kDummy;
-  }
-};
-
-class TokenizerImpl {
+/**
+ * the handler ParserImpl and PushParserImpl build a Value with.
+ * every value is assigned in place into its slot: the root, the member
+ * named by the last key or a new element of the innermost open array.
+ */
+class DocumentBuilder {
  public:
-  TokenizerImpl(const std::string* csonpp_str)
-      : csonpp_str_(csonpp_str),
-        cur_pos_(0) {
-    assert(csonpp_str_);
-  }
+  DocumentBuilder()
+      : root_(nullptr),
+        arena_(nullptr),
+        slot_(nullptr) {}
 
-  ~TokenizerImpl() {
+  // root is replaced by the document, whose strings, objects and arrays
+  // are allocated in arena if it is set
+  void Reset(Value& root, Arena* arena) {
+    root_ = &root;
+    arena_ = arena;
+    stack_.clear();
+    slot_ = nullptr;
   }
 
-  void Reset() {
-    csonpp_str_ = nullptr;
-    cur_pos_ = 0;
+  bool Null() {
+    Slot() = Value(nullptr);
+    return true;
   }
 
-  int GetNextChar() {
-    return (*csonpp_str_)[cur_pos_++];
+  bool Bool(bool value) {
+    Slot() = value;
+    return true;
   }
 
-  void UngetNextChar() {
-    cur_pos_--;
+  bool Int64(int64_t value) {
+    Slot() = value;
+    return true;
   }
 
-  Token GetToken();
-
- private:
-  const std::string* csonpp_str_;
-  size_t cur_pos_;
-
-  int32_t DecodeUnicode();
-};
-
-class ParserImpl {
-public:
-  ParserImpl() {}
-  ~ParserImpl() {}
-
-  bool Deserialize(const std::string& csonpp_str, Value& value);
-  void Serialize(const Value& value, std::string& csonpp_str) const;
-
-private:
-  std::shared_ptr<TokenizerImpl> tokenizer_;
-
-  bool ParseValue(Value& value);
-  bool ParseObject(Value& value);
-  bool ParseMembers(Value& value);
-  bool ParsePair(Value& value);
-  bool ParseArray(Value& value);
-  bool ParseElements(Value& value);
-
-  std::string SerializeObject(const Value& value) const;
-  std::string SerializeArray(const Value& value) const;
-  std::string SerializeString(const std::string& utf8_str) const;
-};
-
-template<class T>
-std::string Number2Str(T num) {
-  return std::to_string(num);
-}
-
-template<>
-std::string Number2Str<float>(float num) {
-  char buf[32];
-#if defined(_MSC_VER) && defined(__STDC_SECURE_LIB__)
-  sprintf_s(buf, 32, "%#.8g", num);
-#else
-  std::sprintf(buf, "%#.8g", num);
-#endif
-  char* tail = buf + strlen(buf) - 1;
-  if (*tail != '0') return buf;
-  while (tail > buf && *tail == '0') {
-    --tail;
-  }
-  char* last_nonzero = tail;
-  while (tail >= buf) {
-    switch (*tail) {
-    case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-      --tail;
-      break;
-    case '.':
-      *(last_nonzero + 2) = '\0';
-      return buf;
-    }
-  }
-  return buf;
-}
-
-template<>
-std::string Number2Str<double>(double num) {
-  char buf[64];
-#if defined(_MSC_VER) && defined(__STDC_SECURE_LIB__)
-  sprintf_s(buf, 64, "%#.16g", num);
-#else
-  std::sprintf(buf, "%#.16g", num);
-#endif
-  char* tail = buf + strlen(buf) - 1;
-  if (*tail != '0') return buf;
-  while (tail > buf && *tail == '0') {
-    --tail;
-  }
-  char* last_nonzero = tail;
-  while (tail >= buf) {
-    switch (*tail) {
-    case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-      --tail;
-      break;
-    case '.':
-      *(last_nonzero + 2) = '\0';
-      return buf;
-    }
-  }
-  return buf;
-}
-
-// TODO
-// do not support long double
-#if 0
-template<>
-std::string Number2Str<long double>(long double num) {
-  char buf[128];
-#if defined(_MSC_VER) && defined(__STDC_SECURE_LIB__)
-  sprintf_s(buf, 128, "%#.32g", num);
-#else
-  std::sprintf(buf, "%#.32g", num);
-#endif
-  char* tail = buf + strlen(buf) - 1;
-  if (*tail != '0') return buf;
-  while (tail > buf && *tail == '0') {
-    --tail;
+  bool Double(double value) {
+    Slot() = value;
+    return true;
   }
-  char* last_nonzero = tail;
-  while (tail >= buf) {
-    switch (*tail) {
-    case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-      --tail;
-      break;
-    case '.':
-      *(last_nonzero + 2) = '\0';
-      return buf;
-    }
-  }
-  return buf;
-}
-#endif
-
-template<class T>
-T Str2Number(const std::string& str, bool* valid = nullptr) {
-  if (valid) {
-    *valid = false;
-  }
-  T res = 0;
-  return res;
-}
-
-template<>
-int8_t Str2Number<int8_t>(const std::string& str, bool* valid) {
-  long result = 0;
-  bool success = true;
-  try {
-    result = std::stol(str);
-    if (result < INT8_MIN || result > INT8_MAX) {
-      success = false;
-      result = 0;
+
+  // the string is taken from the buffer of the tokenizer. one too long
+  // for the size of a borrowed string can not be put in an arena
+  bool String(std::string& value) {
+    if (!arena_) {
+      Slot() = std::move(value);
+    } else if (value.size() > UINT32_MAX) {
+      return false;
+    } else {
+      Slot().ResetInArena(value.data(), value.size(), *arena_);
     }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
+    return true;
   }
 
-  if (valid) {
-    *valid = success;
+  // a string decoded in situ, the Value refers to it
+  bool String(const char* value, size_t size) {
+    Slot().SetBorrowedString(value, size);
+    return true;
   }
 
-  return static_cast<int8_t>(result);
-}
-
-template<>
-uint8_t Str2Number<uint8_t>(const std::string& str, bool* valid) {
-  unsigned long result = 0;
-  bool success = true;
-  try {
-    result = std::stoul(str);
-    if (result > UINT8_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
+  bool StartObject() {
+    return Start(Value::Type::kObject);
   }
 
-  if (valid) {
-    *valid = success;
+  bool Key(const std::string& key) {
+    slot_ = &(*stack_.back())[key];
+    return true;
   }
 
-  return static_cast<uint8_t>(result);
-}
-
-template<>
-int16_t Str2Number<int16_t>(const std::string& str, bool* valid) {
-  long result = 0;
-  bool success = true;
-  try {
-    result = std::stol(str);
-    if (result < INT16_MIN || result > INT16_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
+  bool EndObject() {
+    stack_.pop_back();
+    return true;
   }
 
-  if (valid) {
-    *valid = success;
+  bool StartArray() {
+    return Start(Value::Type::kArray);
   }
 
-  return static_cast<int16_t>(result);
-}
-
-template<>
-uint16_t Str2Number<uint16_t>(const std::string& str, bool* valid) {
-  unsigned long result = 0;
-  bool success = true;
-  try {
-    result = std::stoul(str);
-    if (result > UINT16_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
+  bool EndArray() {
+    stack_.pop_back();
+    return true;
   }
 
-  if (valid) {
-    *valid = success;
+ private:
+  Value* root_;
+  Arena* arena_;
+  // the objects and arrays being built, the innermost one last
+  std::vector<Value*> stack_;
+  // the member named by the last key
+  Value* slot_;
+
+  Value& Slot() {
+    if (stack_.empty())
+      return *root_;
+    Value& container = *stack_.back();
+    if (container.IsObject())
+      return *slot_;
+    container.Append(Value());
+    return container[container.Size() - 1];
+  }
+
+  // an empty object or array, in arena_ if it is set
+  bool Start(Value::Type type) {
+    Value& value = Slot();
+    if (arena_)
+      value.ResetInArena(type, *arena_);
+    else
+      value = Value(type);
+    stack_.push_back(&value);
+    return true;
   }
+};
 
-  return static_cast<uint16_t>(result);
-}
-
-template<>
-int32_t Str2Number<int32_t>(const std::string& str, bool* valid) {
-  long result = 0;
-  bool success = true;
-  try {
-    result = std::stol(str);
-    if (result < INT32_MIN || result > INT32_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
-  }
+class ParserImpl {
+public:
+  explicit ParserImpl(size_t max_depth = Parser::kDefaultMaxDepth)
+      : core_(max_depth),
+        arena_(nullptr) {}
+  ~ParserImpl() {}
 
-  if (valid) {
-    *valid = success;
-  }
+  bool Deserialize(const char* csonpp_str, size_t size, Value& value);
+  bool Deserialize(const char* csonpp_str, size_t size, Document& document);
+  bool DeserializeInSitu(char* csonpp_str, size_t size, Value& value);
+  void Serialize(const Value& value, std::string& csonpp_str) const;
 
-  return static_cast<int32_t>(result);
-}
-
-template<>
-uint32_t Str2Number<uint32_t>(const std::string& str, bool* valid) {
-  unsigned long result = 0;
-  bool success = true;
-  try {
-    result = std::stoul(str);
-    if (result > UINT32_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
-  }
+  // all of them append to csonpp_str, utf8_str is '\0' terminated
+  static void SerializeString(const char* utf8_str, 
+                              size_t size, 
+                              std::string& csonpp_str);
+  static void SerializeInteger(int64_t num, std::string& csonpp_str);
+  static void SerializeDouble(double num, std::string& csonpp_str);
 
-  if (valid) {
-    *valid = success;
-  }
+private:
+  detail::ParserCore core_;
+  DocumentBuilder builder_;
+  // the arena of the document being parsed, if any
+  Arena* arena_;
 
-  return static_cast<uint32_t>(result);
-}
-
-template<>
-int64_t Str2Number<int64_t>(const std::string& str, bool* valid) {
-  long long result = 0;
-  bool success = true;
-  try {
-    result = std::stoll(str);
-    if (result < INT64_MIN || result > INT64_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
-  }
+  // the input is set on core_
+  bool ParseDocument(Value& value, bool insitu);
 
-  if (valid) {
-    *valid = success;
-  }
+  // append to csonpp_str
+  void SerializeValue(const Value& value, std::string& csonpp_str) const;
+};
 
-  return static_cast<int64_t>(result);
-}
-
-template<>
-uint64_t Str2Number<uint64_t>(const std::string& str, bool* valid) {
-  unsigned long long result = 0;
-  bool success = true;
-  try {
-    result = std::stoull(str);
-    if (result > UINT64_MAX) {
-      success = false;
-      result = 0;
-    }
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0;
-  }
+// where a ReaderImpl refills its window from
+class InputSource {
+ public:
+  virtual ~InputSource() {}
 
-  if (valid) {
-    *valid = success;
-  }
+  // @return the count of bytes read into buf, 0 at the end or on an error
+  virtual size_t Read(char* buf, size_t size) = 0;
+};
 
-  return static_cast<uint64_t>(result);
-}
-
-template<>
-float Str2Number<float>(const std::string& str, bool* valid) {
-  float result = 0.;
-  bool success = true;
-  try {
-    result = std::stof(str);
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0.;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0.;
-  }
+class ReaderImpl {
+ public:
+  ReaderImpl(const char* csonpp_str, size_t size, size_t max_depth);
+  ReaderImpl(std::unique_ptr<InputSource> source, 
+             size_t max_depth, 
+             size_t buffer_size);
 
-  if (valid) {
-    *valid = success;
-  }
+  Reader::Event Next();
 
-  return result;
-}
-
-template<>
-double Str2Number<double>(const std::string& str, bool* valid) {
-  double result = 0.;
-  bool success = true;
-  try {
-    result = std::stod(str);
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0.;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0.;
-  }
+  bool GetBool() const { return recorder_.bool_; }
+  int64_t GetInteger() const { return recorder_.integer_; }
+  double GetDouble() const { return recorder_.double_; }
+  const std::string& GetString() const { return recorder_.string_; }
 
-  if (valid) {
-    *valid = success;
-  }
+ private:
+  // the handler of core_, it keeps the last part of the document
+  struct EventRecorder {
+    Reader::Event event_;
+    bool bool_;
+    int64_t integer_;
+    double double_;
+    std::string string_;
+
+    EventRecorder()
+        : event_(Reader::Event::kError),
+          bool_(false),
+          integer_(0),
+          double_(0.) {}
+
+    bool Null() { return Record(Reader::Event::kNull); }
+    bool Bool(bool value) { bool_ = value; return Record(Reader::Event::kBool); }
+    bool Int64(int64_t value) { integer_ = value; return Record(Reader::Event::kInteger); }
+    bool Double(double value) { double_ = value; return Record(Reader::Event::kDouble); }
+    bool String(std::string& value) { string_.swap(value); return Record(Reader::Event::kString); }
+    bool Key(std::string& key) { string_.swap(key); return Record(Reader::Event::kKey); }
+    bool StartObject() { return Record(Reader::Event::kStartObject); }
+    bool EndObject() { return Record(Reader::Event::kEndObject); }
+    bool StartArray() { return Record(Reader::Event::kStartArray); }
+    bool EndArray() { return Record(Reader::Event::kEndArray); }
+
+    bool Record(Reader::Event event) {
+      event_ = event;
+      return true;
+    }
+  };
 
-  return result;
-}
-
-template<>
-long double Str2Number<long double>(const std::string& str, bool* valid) {
-  long double result = 0.;
-  bool success = true;
-  try {
-    result = std::stold(str);
-  } catch (std::invalid_argument&) {
-    success = false;
-    result = 0.;
-  } catch (std::out_of_range) {
-    success = false;
-    result = 0.;
-  }
+  detail::ParserCore core_;
+  EventRecorder recorder_;
+
+  // the input read so far and not consumed yet is window_[0, window_end_).
+  // there is no source for an input in memory
+  std::unique_ptr<InputSource> source_;
+  std::vector<char> window_;
+  size_t window_end_;
+  bool source_end_;
+
+  void FillWindow();
+};
 
-  if (valid) {
-    *valid = success;
+class PushParserImpl {
+ public:
+  explicit PushParserImpl(size_t max_depth)
+      : core_(max_depth),
+        failed_(false) {
+    Reset();
   }
 
-  return result;
-}
+  bool Feed(const char* chunk, size_t size);
+  bool Finish(Value& value);
+  void Reset();
+
+ private:
+  detail::ParserCore core_;
+  DocumentBuilder builder_;
+  Value root_;
+  // the bytes the tokenizer still needs from the chunks fed so far,
+  // a chunk is appended to them when there are some
+  std::string buffer_;
+  bool failed_;
+
+  // parse what core_ is set on, false on an error
+  bool Run();
+};
 
 }  // namespace csonpp
 
@@ -0,0 +1,178 @@
+#include "csonpp_impl.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <istream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CSONPP_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+namespace csonpp {
+
+namespace {
+
+class FdSource : public InputSource {
+ public:
+  explicit FdSource(int fd) : fd_(fd) {}
+
+  size_t Read(char* buf, size_t size) override {
+    while (true) {
+#ifdef _WIN32
+      int count = _read(fd_, buf, 
+                        static_cast<unsigned>(std::min<size_t>(size, INT_MAX)));
+#else
+      ssize_t count = read(fd_, buf, size);
+#endif
+      if (count >= 0)
+        return static_cast<size_t>(count);
+      if (errno != EINTR)
+        return 0;
+    }
+  }
+
+ private:
+  int fd_;
+};
+
+class StreamSource : public InputSource {
+ public:
+  explicit StreamSource(std::istream& stream) : stream_(stream) {}
+
+  size_t Read(char* buf, size_t size) override {
+    if (!stream_.good())
+      return 0;
+    stream_.read(buf, size);
+    return static_cast<size_t>(stream_.gcount());
+  }
+
+ private:
+  std::istream& stream_;
+};
+
+}  // namespace
+
+Reader::Reader(int fd, size_t max_depth, size_t buffer_size)
+    : impl_(std::make_shared<ReaderImpl>(
+          std::unique_ptr<InputSource>(new FdSource(fd)), 
+          max_depth, 
+          buffer_size)) {
+}
+
+Reader::Reader(std::istream& stream, size_t max_depth, size_t buffer_size)
+    : impl_(std::make_shared<ReaderImpl>(
+          std::unique_ptr<InputSource>(new StreamSource(stream)), 
+          max_depth, 
+          buffer_size)) {
+}
+
+MappedFile::MappedFile()
+    : data_(nullptr),
+      size_(0),
+      writable_(false) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#ifdef CSONPP_HAS_MMAP
+
+bool MappedFile::Open(const std::string& path, bool writable) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+
+  writable_ = writable;
+  size_ = static_cast<size_t>(st.st_size);
+  if (!size_) {
+    // nothing to map, an empty input
+    close(fd);
+    return true;
+  }
+
+  int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  flags |= MAP_POPULATE;
+#endif
+  int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void* data = mmap(nullptr, size_, protection, flags, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    size_ = 0;
+    return false;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(data, size_, MADV_SEQUENTIAL);
+#endif
+  data_ = static_cast<char*>(data);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_)
+    munmap(data_, size_);
+  data_ = nullptr;
+  size_ = 0;
+  writable_ = false;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path, bool writable) {
+  Close();
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  bool ok = (fseek(file, 0, SEEK_END) == 0);
+  long size = ok ? ftell(file) : -1;
+  ok = (size >= 0 && fseek(file, 0, SEEK_SET) == 0);
+  if (ok && size > 0) {
+    data_ = static_cast<char*>(malloc(size));
+    ok = data_ && fread(data_, 1, size, file) == static_cast<size_t>(size);
+  }
+  fclose(file);
+  if (!ok) {
+    Close();
+    return false;
+  }
+  size_ = static_cast<size_t>(size);
+  writable_ = writable;
+  return true;
+}
+
+void MappedFile::Close() {
+  free(data_);
+  data_ = nullptr;
+  size_ = 0;
+  writable_ = false;
+}
+
+#endif  // CSONPP_HAS_MMAP
+
+bool Parser::DeserializeFile(const std::string& path, 
+                             Value& value, 
+                             size_t max_depth) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    value = Value();
+    return false;
+  }
+  return Deserialize(file.GetData(), file.GetSize(), value, max_depth);
+}
+
+}  // namespace csonpp
@@ -0,0 +1,71 @@
+#ifndef CSONPP_NUMBER_IMPL_H_
+#define CSONPP_NUMBER_IMPL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace csonpp {
+
+namespace detail {
+
+/**
+ * convert a decimal integer, an optional '-' followed by at least one digit,
+ * straight from the input bytes.
+ * no exception is thrown and nothing is allocated.
+ * @param str     the integer, not necessarily '\0' terminated
+ * @param size    the number of bytes of the integer
+ * @param result  the converted value, untouched on failure
+ * @return false if str is not an integer or it does not fit in int64_t
+ */
+bool ParseInt64(const char* str, size_t size, int64_t& result);
+
+/**
+ * convert a json number to the nearest double, ties to even.
+ * the Clinger fast path handles small exact cases, the Eisel-Lemire
+ * algorithm nearly all the others, and a decimal big number is the fallback
+ * for the rare inputs it can not decide.
+ * the current locale is never consulted, nothing is allocated
+ * and no exception is thrown.
+ * @param str     the number, not necessarily '\0' terminated
+ * @param size    the number of bytes of the number
+ * @param result  the converted value, untouched on failure
+ * @return false if str is not a json number or it overflows a double
+ */
+bool ParseDouble(const char* str, size_t size, double& result);
+
+}  // namespace detail
+
+/**
+ * the longest text FormatInt64() writes, i.e. -9223372036854775808
+ */
+const size_t kMaxInt64Length = 20;
+
+/**
+ * write the decimal text of an integer, two digits at a time from a table
+ * of digit pairs, without any temporary string.
+ * @param value   the number
+ * @param buffer  at least kMaxInt64Length bytes, no '\0' is appended
+ * @return the end of the written text
+ */
+char* FormatInt64(int64_t value, char* buffer);
+
+/**
+ * the longest text FormatDouble() writes, e.g. -1.2345678901234567e-308
+ */
+const size_t kMaxDoubleLength = 25;
+
+/**
+ * write the shortest text that parses back to exactly the same double,
+ * found with the Schubfach algorithm.
+ * the text always has a '.' or an exponent so it reads back as a double:
+ * 1.0, -0.012, 120000.0, 1e+20, 1.5e-7.
+ * json has no nan nor infinity, they are written as null.
+ * @param value   the number
+ * @param buffer  at least kMaxDoubleLength bytes, no '\0' is appended
+ * @return the end of the written text
+ */
+char* FormatDouble(double value, char* buffer);
+
+}  // namespace csonpp
+
+#endif  // CSONPP_NUMBER_IMPL_H_
@@ -0,0 +1,550 @@
+#include "csonpp_impl.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+
+namespace csonpp {
+
+namespace {
+
+inline const char* SkipWhitespaces(const char* cur, const char* end) {
+  while (cur < end && isspace(static_cast<unsigned char>(*cur)))
+    ++cur;
+  return cur;
+}
+
+/**
+ * @param cur  the opening '"'
+ * @return the charactor after the closing '"', nullptr if there is none
+ */
+const char* SkipString(const char* cur, const char* end) {
+  ++cur;
+  while (true) {
+    cur = detail::FindStringSpecial(cur, end);
+    if (cur == end)
+      return nullptr;
+    if (*cur == '\"')
+      return cur + 1;
+    if (*cur == '\\' && ++cur == end)
+      return nullptr;
+    ++cur;
+  }
+}
+
+// the charactor after true, false, null or a number
+inline const char* SkipScalar(const char* cur, const char* end) {
+  while (cur < end) {
+    switch (*cur) {
+    case ',': case '}': case ']': case ':':
+    case ' ': case '\t': case '\n': case '\r': case '\f': case '\v':
+      return cur;
+    default:
+      ++cur;
+    }
+  }
+  return cur;
+}
+
+/**
+ * skip a whole value, objects and arrays by matching their brackets
+ * @param cur  the first charactor of the value
+ * @return the charactor after the value, nullptr if it is not terminated
+ */
+const char* SkipValue(const char* cur, const char* end) {
+  if (cur == end)
+    return nullptr;
+  if (*cur == '\"')
+    return SkipString(cur, end);
+  if (*cur != '{' && *cur != '[') {
+    const char* scalar_end = SkipScalar(cur, end);
+    return (scalar_end == cur) ? nullptr : scalar_end;
+  }
+
+  size_t depth = 0;
+  while (cur < end) {
+    switch (*cur) {
+    case '\"':
+      cur = SkipString(cur, end);
+      if (!cur)
+        return nullptr;
+      continue;
+    case '{': case '[':
+      ++depth;
+      break;
+    case '}': case ']':
+      if (--depth == 0)
+        return cur + 1;
+      break;
+    default:
+      break;
+    }
+    ++cur;
+  }
+  return nullptr;
+}
+
+/**
+ * move from the end of a member or an element to the start of the next one
+ * @param cur    after '{' or '[', or after a member or an element
+ * @param close  '}' or ']'
+ * @return the first charactor of the next one, nullptr at the closing
+ *         bracket or on an error
+ */
+const char* NextItem(const char* cur, const char* end, bool first, char close) {
+  cur = SkipWhitespaces(cur, end);
+  if (cur == end || *cur == close)
+    return nullptr;
+  if (!first) {
+    if (*cur != ',')
+      return nullptr;
+    cur = SkipWhitespaces(cur + 1, end);
+  }
+  return (cur == end) ? nullptr : cur;
+}
+
+/**
+ * @param begin  the opening '"'
+ * @param end    after the closing '"'
+ */
+bool DecodeString(const char* begin, const char* end, std::string& str) {
+  detail::Tokenizer tokenizer(begin, end - begin);
+  if (tokenizer.GetToken().type_ != detail::Token::Type::kString)
+    return false;
+  str.swap(tokenizer.GetStringBuffer());
+  return true;
+}
+
+/**
+ * compare the raw text of a key with a decoded key,
+ * the text is only decoded if it has an escape
+ * @param begin  the opening '"'
+ * @param end    after the closing '"'
+ */
+bool KeyEquals(const char* begin, const char* end, const std::string& key) {
+  const char* body = begin + 1;
+  size_t size = end - body - 1;
+  if (!memchr(body, '\\', size))
+    return size == key.size() && memcmp(body, key.data(), size) == 0;
+
+  std::string decoded;
+  return DecodeString(begin, end, decoded) && decoded == key;
+}
+
+// the JSON Pointers given to Parser::DeserializeFields() merged into a tree
+// of their segments
+struct FieldNode {
+  struct Member {
+    std::string key;
+    // the array index the key stands for, SIZE_MAX if none
+    size_t index;
+    std::unique_ptr<FieldNode> node;
+  };
+
+  // the value is selected with all its descendants
+  bool whole = false;
+  std::vector<Member> members;
+  // the "*" segment
+  std::unique_ptr<FieldNode> any;
+};
+
+// an array index has no sign and no leading zero
+size_t SegmentToIndex(const std::string& segment) {
+  if (segment.empty() || segment.size() > 18 ||
+      (segment[0] == '0' && segment.size() > 1))
+    return SIZE_MAX;
+  size_t index = 0;
+  for (size_t i = 0; i < segment.size(); ++i) {
+    if (segment[i] < '0' || segment[i] > '9')
+      return SIZE_MAX;
+    index = index * 10 + (segment[i] - '0');
+  }
+  return index;
+}
+
+FieldNode* GetChild(FieldNode& node, const std::string& segment) {
+  if (segment == "*") {
+    if (!node.any)
+      node.any.reset(new FieldNode());
+    return node.any.get();
+  }
+  for (size_t i = 0; i < node.members.size(); ++i) {
+    if (node.members[i].key == segment)
+      return node.members[i].node.get();
+  }
+  FieldNode::Member member;
+  member.key = segment;
+  member.index = SegmentToIndex(segment);
+  member.node.reset(new FieldNode());
+  node.members.push_back(std::move(member));
+  return node.members.back().node.get();
+}
+
+// @return false if pointer is not a JSON Pointer
+bool AddPointer(FieldNode& root, const std::string& pointer) {
+  FieldNode* node = &root;
+  if (!pointer.empty() && pointer[0] != '/')
+    return false;
+  std::string segment;
+  for (size_t i = 1; i <= pointer.size(); ++i) {
+    if (i == pointer.size() || pointer[i] == '/') {
+      node = GetChild(*node, segment);
+      segment.clear();
+    } else if (pointer[i] == '~') {
+      if (i + 1 == pointer.size() || 
+          (pointer[i + 1] != '0' && pointer[i + 1] != '1'))
+        return false;
+      segment += (pointer[++i] == '0') ? '~' : '/';
+    } else {
+      segment += pointer[i];
+    }
+  }
+  node->whole = true;
+  return true;
+}
+
+void MergeFields(FieldNode& dst, const FieldNode& src) {
+  dst.whole = dst.whole || src.whole;
+  for (size_t i = 0; i < src.members.size(); ++i)
+    MergeFields(*GetChild(dst, src.members[i].key), *src.members[i].node);
+  if (src.any)
+    MergeFields(*GetChild(dst, "*"), *src.any);
+}
+
+// copy what "*" selects into its named siblings, so that a member or an
+// element is only ever matched by a single node
+void SpreadWildcards(FieldNode& node) {
+  for (size_t i = 0; i < node.members.size(); ++i) {
+    if (node.any)
+      MergeFields(*node.members[i].node, *node.any);
+    SpreadWildcards(*node.members[i].node);
+  }
+  if (node.any)
+    SpreadWildcards(*node.any);
+}
+
+/**
+ * build the parts of a value selected by node
+ * @param cur    the first charactor of the value
+ * @param depth  the count of objects and arrays around the value
+ * @param found  set if anything is selected, value is left alone otherwise
+ * @return the charactor after the value, nullptr on an error
+ */
+const char* SelectFields(const char* cur, 
+                         const char* end, 
+                         const FieldNode& node, 
+                         size_t depth, 
+                         size_t max_depth, 
+                         Value& value, 
+                         bool& found) {
+  if (node.whole) {
+    const char* value_end = SkipValue(cur, end);
+    if (!value_end)
+      return nullptr;
+    ParserImpl parser(max_depth - depth);
+    if (!parser.Deserialize(cur, value_end - cur, value))
+      return nullptr;
+    found = true;
+    return value_end;
+  }
+  if (cur == end || (*cur != '{' && *cur != '[') ||
+      (node.members.empty() && !node.any))
+    return SkipValue(cur, end);
+  if (depth >= max_depth)
+    return nullptr;
+
+  bool is_object = (*cur == '{');
+  char close = is_object ? '}' : ']';
+  Value selected(is_object ? Value::Type::kObject : Value::Type::kArray);
+  std::string key;
+  const char* first = cur + 1;
+  size_t index = 0;
+  cur = first;
+  while (true) {
+    const char* item = NextItem(cur, end, cur == first, close);
+    if (!item)
+      break;
+
+    const char* key_end = nullptr;
+    if (is_object) {
+      if (*item != '\"' || !(key_end = SkipString(item, end)))
+        return nullptr;
+      const char* colon = SkipWhitespaces(key_end, end);
+      if (colon == end || *colon != ':')
+        return nullptr;
+      cur = SkipWhitespaces(colon + 1, end);
+    } else {
+      cur = item;
+    }
+
+    const FieldNode* child = nullptr;
+    for (size_t i = 0; i < node.members.size() && !child; ++i) {
+      const FieldNode::Member& member = node.members[i];
+      if (is_object ? KeyEquals(item, key_end, member.key) : 
+                      member.index == index)
+        child = member.node.get();
+    }
+    if (!child)
+      child = node.any.get();
+
+    if (child) {
+      Value item_value;
+      bool item_found = false;
+      cur = SelectFields(cur, end, *child, depth + 1, max_depth, 
+                         item_value, item_found);
+      if (cur && item_found) {
+        if (!is_object) {
+          selected.Append(std::move(item_value));
+        } else if (DecodeString(item, key_end, key)) {
+          selected[key] = std::move(item_value);
+        } else {
+          return nullptr;
+        }
+        found = true;
+      }
+    } else {
+      cur = SkipValue(cur, end);
+    }
+    if (!cur)
+      return nullptr;
+    ++index;
+  }
+
+  // NextItem() stops at the closing bracket as well as on an error
+  cur = SkipWhitespaces(cur, end);
+  if (cur == end || *cur != close)
+    return nullptr;
+  if (found)
+    value = std::move(selected);
+  return cur + 1;
+}
+
+}  // namespace
+
+OnDemandValue::OnDemandValue()
+    : begin_(nullptr),
+      end_(nullptr),
+      cursor_(nullptr),
+      cursor_index_(0) {
+}
+
+OnDemandValue::OnDemandValue(const char* begin, const char* end)
+    : begin_(SkipWhitespaces(begin, end)),
+      end_(end),
+      cursor_(nullptr),
+      cursor_index_(0) {
+}
+
+Value::Type OnDemandValue::GetType() const {
+  if (!begin_ || begin_ == end_)
+    return Value::Type::kDummy;
+  switch (*begin_) {
+  case '{': return Value::Type::kObject;
+  case '[': return Value::Type::kArray;
+  case '\"': return Value::Type::kString;
+  case 't': case 'f': return Value::Type::kBool;
+  case 'n': return Value::Type::kNull;
+  case '-':
+  case '0': case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9': {
+    const char* scalar_end = SkipScalar(begin_, end_);
+    for (const char* cur = begin_; cur < scalar_end; ++cur) {
+      if (*cur == '.' || *cur == 'e' || *cur == 'E')
+        return Value::Type::kDouble;
+    }
+    return Value::Type::kInteger;
+  }
+  default:
+    return Value::Type::kDummy;
+  }
+}
+
+OnDemandValue OnDemandValue::operator[](const std::string& key) {
+  if (GetType() != Value::Type::kObject)
+    return OnDemandValue();
+
+  // one pass from the cursor to the end, then one from the first member
+  // back to the cursor
+  const char* first = begin_ + 1;
+  const char* start = cursor_ ? cursor_ : first;
+  for (int pass = 0; pass < 2; ++pass) {
+    const char* cur = (pass == 0) ? start : first;
+    const char* stop = (pass == 0) ? end_ : start;
+    if (pass == 1 && start == first)
+      break;
+    while (cur < stop) {
+      cur = NextItem(cur, end_, cur == first, '}');
+      if (!cur || *cur != '\"')
+        break;
+      const char* key_end = SkipString(cur, end_);
+      if (!key_end)
+        break;
+      const char* colon = SkipWhitespaces(key_end, end_);
+      if (colon == end_ || *colon != ':')
+        break;
+      const char* value_begin = SkipWhitespaces(colon + 1, end_);
+      const char* value_end = SkipValue(value_begin, end_);
+      if (!value_end)
+        break;
+      if (KeyEquals(cur, key_end, key)) {
+        cursor_ = value_end;
+        return OnDemandValue(value_begin, end_);
+      }
+      cur = value_end;
+    }
+  }
+  return OnDemandValue();
+}
+
+OnDemandValue OnDemandValue::operator[](size_t i) {
+  if (GetType() != Value::Type::kArray)
+    return OnDemandValue();
+
+  const char* first = begin_ + 1;
+  const char* cur = first;
+  size_t index = 0;
+  if (cursor_ && cursor_index_ <= i) {
+    cur = cursor_;
+    index = cursor_index_;
+  }
+  while (true) {
+    cur = NextItem(cur, end_, cur == first, ']');
+    if (!cur)
+      return OnDemandValue();
+    const char* element_end = SkipValue(cur, end_);
+    if (!element_end)
+      return OnDemandValue();
+    if (index == i) {
+      cursor_ = element_end;
+      cursor_index_ = i + 1;
+      return OnDemandValue(cur, end_);
+    }
+    cur = element_end;
+    ++index;
+  }
+}
+
+size_t OnDemandValue::Size() const {
+  Value::Type type = GetType();
+  if (type != Value::Type::kObject && type != Value::Type::kArray)
+    return 0;
+
+  char close = (type == Value::Type::kObject) ? '}' : ']';
+  const char* first = begin_ + 1;
+  const char* cur = first;
+  size_t size = 0;
+  while (true) {
+    cur = NextItem(cur, end_, cur == first, close);
+    if (!cur)
+      return size;
+    if (type == Value::Type::kObject) {
+      cur = SkipString(cur, end_);
+      if (!cur)
+        return size;
+      cur = SkipWhitespaces(cur, end_);
+      if (cur == end_ || *cur != ':')
+        return size;
+      cur = SkipWhitespaces(cur + 1, end_);
+    }
+    cur = SkipValue(cur, end_);
+    if (!cur)
+      return size;
+    ++size;
+  }
+}
+
+bool OnDemandValue::GetInteger(int64_t& integer) const {
+  if (GetType() != Value::Type::kInteger)
+    return false;
+  return detail::ParseInt64(begin_, SkipScalar(begin_, end_) - begin_, integer);
+}
+
+bool OnDemandValue::GetDouble(double& num) const {
+  Value::Type type = GetType();
+  if (type != Value::Type::kDouble && type != Value::Type::kInteger)
+    return false;
+  return detail::ParseDouble(begin_, SkipScalar(begin_, end_) - begin_, num);
+}
+
+bool OnDemandValue::GetBool(bool& boolean) const {
+  if (GetType() != Value::Type::kBool)
+    return false;
+  size_t size = SkipScalar(begin_, end_) - begin_;
+  if (size == 4 && memcmp(begin_, "true", 4) == 0) {
+    boolean = true;
+    return true;
+  }
+  if (size == 5 && memcmp(begin_, "false", 5) == 0) {
+    boolean = false;
+    return true;
+  }
+  return false;
+}
+
+bool OnDemandValue::GetString(std::string& str) const {
+  if (GetType() != Value::Type::kString)
+    return false;
+  detail::Tokenizer tokenizer(begin_, end_ - begin_);
+  if (tokenizer.GetToken().type_ != detail::Token::Type::kString)
+    return false;
+  str.swap(tokenizer.GetStringBuffer());
+  return true;
+}
+
+bool OnDemandValue::IsNull() const {
+  return GetType() == Value::Type::kNull &&
+         SkipScalar(begin_, end_) - begin_ == 4 &&
+         memcmp(begin_, "null", 4) == 0;
+}
+
+bool OnDemandValue::ToValue(Value& value) const {
+  const char* value_end = begin_ ? SkipValue(begin_, end_) : nullptr;
+  if (!value_end) {
+    value = Value();
+    return false;
+  }
+  ParserImpl impl;
+  return impl.Deserialize(begin_, value_end - begin_, value);
+}
+
+bool Parser::DeserializeFields(const char* csonpp_str, 
+                               size_t size, 
+                               const std::vector<std::string>& pointers, 
+                               Value& value, 
+                               size_t max_depth) {
+  auto error_occured = [&value] {
+    value = Value();
+    return false;
+  };
+
+  FieldNode root;
+  for (size_t i = 0; i < pointers.size(); ++i) {
+    if (!AddPointer(root, pointers[i]))
+      return error_occured();
+  }
+  SpreadWildcards(root);
+
+  const char* end = csonpp_str + size;
+  const char* cur = SkipWhitespaces(csonpp_str, end);
+  Value selected;
+  bool found = false;
+  if (cur == end)
+    return error_occured();
+  cur = SelectFields(cur, end, root, 0, max_depth, selected, found);
+  // nothing but whitespaces may follow the document
+  if (!cur || SkipWhitespaces(cur, end) != end)
+    return error_occured();
+  value = found ? std::move(selected) : Value(nullptr);
+  return true;
+}
+
+OnDemandDocument::OnDemandDocument(const char* csonpp_str, size_t size)
+    : root_(csonpp_str, csonpp_str + size) {
+}
+
+OnDemandDocument::OnDemandDocument(const std::string& csonpp_str)
+    : root_(csonpp_str.data(), csonpp_str.data() + csonpp_str.size()) {
+}
+
+}  // namespace csonpp
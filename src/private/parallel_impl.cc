@@ -0,0 +1,345 @@
+#include "parallel_impl.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+namespace csonpp {
+
+namespace {
+
+// the pool and the index of the thread running the caller,
+// current_pool is nullptr outside of the pools
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+// smaller documents are not worth the threads
+const size_t kParallelMinSize = 1 << 20;
+// the elements are parsed in batches, several per thread so that the
+// threads done first steal from the others
+const size_t kBatchesPerThread = 8;
+
+/**
+ * find the elements of a top-level array from its structural index
+ * @param boundaries  receives the position of the '[', of every top-level
+ *                    ',' and of the closing ']', element i lies between
+ *                    boundaries[i] and boundaries[i + 1]
+ * @return false if the document is not an array or its brackets do not match
+ */
+bool FindElements(const char* csonpp_str,
+                  const std::vector<uint32_t>& structurals,
+                  std::vector<size_t>& boundaries) {
+  if (structurals.empty() || csonpp_str[structurals[0]] != '[')
+    return false;
+  size_t depth = 0;
+  for (size_t i = 0; i < structurals.size(); ++i) {
+    uint32_t pos = structurals[i];
+    switch (csonpp_str[pos]) {
+    case '[': case '{':
+      if (++depth == 1)
+        boundaries.push_back(pos);
+      break;
+    case ']': case '}':
+      if (--depth == 0) {
+        boundaries.push_back(pos);
+        // nothing may follow the array
+        return csonpp_str[pos] == ']' && i + 1 == structurals.size();
+      }
+      break;
+    case ',':
+      if (depth == 1)
+        boundaries.push_back(pos);
+      break;
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads)
+    : pending_(0),
+      stop_(false),
+      next_worker_(0) {
+  if (!threads)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < threads; ++i)
+    workers_.emplace_back(new Worker());
+  for (size_t i = 0; i < threads; ++i)
+    threads_.emplace_back(&ThreadPool::Run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wakeup_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+void ThreadPool::Submit(Task task) {
+  size_t index = (current_pool == this) ?
+                 current_worker :
+                 next_worker_++ % workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++pending_;
+  }
+  wakeup_.notify_one();
+}
+
+void ThreadPool::Run(size_t index) {
+  current_pool = this;
+  current_worker = index;
+  Task task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeup_.wait(lock, [this] { return pending_ > 0 || stop_; });
+      if (!pending_)
+        return;
+      --pending_;
+    }
+    // pending_ counted the task, some deque holds it
+    while (!PopTask(index, task))
+      std::this_thread::yield();
+    task();
+    task = nullptr;
+  }
+}
+
+bool ThreadPool::PopTask(size_t index, Task& task) {
+  {
+    Worker& own = *workers_[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker& victim = *workers_[(index + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+ParallelDocumentStreamImpl::ParallelDocumentStreamImpl(
+    const char* csonpp_str,
+    size_t size,
+    const ParallelDocumentStream::Options& options)
+    : begin_(csonpp_str),
+      cur_(csonpp_str),
+      end_(csonpp_str + size),
+      options_(options),
+      max_chunks_(0),
+      next_document_(0),
+      offset_(0),
+      stopping_(false),
+      pool_(options.threads) {
+  max_chunks_ = options.max_chunks ?
+                options.max_chunks :
+                4 * pool_.GetThreadCount();
+  if (!options_.chunk_size)
+    options_.chunk_size = 1;
+}
+
+ParallelDocumentStreamImpl::~ParallelDocumentStreamImpl() {
+  // the queued chunks are not worth parsing any more
+  stopping_ = true;
+}
+
+/**
+ * cut the input into chunks of whole lines and submit them
+ * until max_chunks_ of them wait for the consumer
+ */
+void ParallelDocumentStreamImpl::SubmitChunks() {
+  while (cur_ < end_ && chunks_.size() < max_chunks_) {
+    const char* chunk_end = end_;
+    if (static_cast<size_t>(end_ - cur_) > options_.chunk_size) {
+      const char* newline = static_cast<const char*>(
+          memchr(cur_ + options_.chunk_size, '\n',
+                 end_ - cur_ - options_.chunk_size));
+      if (newline)
+        chunk_end = newline + 1;
+    }
+
+    std::unique_ptr<DocumentChunk> chunk(new DocumentChunk());
+    chunk->begin = cur_;
+    chunk->size = chunk_end - cur_;
+    chunk->offset = cur_ - begin_;
+    chunk->done = false;
+    DocumentChunk* raw_chunk = chunk.get();
+    chunks_.push_back(std::move(chunk));
+    pool_.Submit([this, raw_chunk] { ParseChunk(raw_chunk); });
+    cur_ = chunk_end;
+  }
+}
+
+void ParallelDocumentStreamImpl::ParseChunk(DocumentChunk* chunk) {
+  if (!stopping_) {
+    DocumentStream stream(chunk->begin, chunk->size, options_.max_depth);
+    Value value;
+    DocumentStream::Status status;
+    while ((status = stream.Next(value)) != DocumentStream::Status::kEnd) {
+      chunk->statuses.push_back(status);
+      chunk->offsets.push_back(chunk->offset + stream.GetOffset());
+      chunk->values.push_back(std::move(value));
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunk->done = true;
+  }
+  chunk_done_.notify_all();
+}
+
+DocumentStream::Status ParallelDocumentStreamImpl::Next(Value& value) {
+  while (true) {
+    if (current_ && next_document_ < current_->values.size()) {
+      size_t i = next_document_++;
+      value = std::move(current_->values[i]);
+      offset_ = current_->offsets[i];
+      return current_->statuses[i];
+    }
+    current_.reset();
+    next_document_ = 0;
+
+    SubmitChunks();
+    if (chunks_.empty())
+      return DocumentStream::Status::kEnd;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (options_.ordered) {
+      chunk_done_.wait(lock, [this] { return chunks_.front()->done; });
+      current_ = std::move(chunks_.front());
+      chunks_.pop_front();
+    } else {
+      std::deque<std::unique_ptr<DocumentChunk>>::iterator done_chunk;
+      chunk_done_.wait(lock, [this, &done_chunk] {
+        done_chunk = std::find_if(
+            chunks_.begin(), chunks_.end(),
+            [] (const std::unique_ptr<DocumentChunk>& chunk) {
+              return chunk->done;
+            });
+        return done_chunk != chunks_.end();
+      });
+      current_ = std::move(*done_chunk);
+      chunks_.erase(done_chunk);
+    }
+  }
+}
+
+ParallelDocumentStream::ParallelDocumentStream(const char* csonpp_str,
+                                               size_t size,
+                                               const Options& options)
+    : impl_(std::make_shared<ParallelDocumentStreamImpl>(
+          csonpp_str, size, options)) {
+}
+
+ParallelDocumentStream::ParallelDocumentStream(const std::string& csonpp_str,
+                                               const Options& options)
+    : ParallelDocumentStream(csonpp_str.data(), csonpp_str.size(), options) {
+}
+
+ParallelDocumentStream::~ParallelDocumentStream() {
+}
+
+DocumentStream::Status ParallelDocumentStream::Next(Value& value) {
+  return impl_->Next(value);
+}
+
+size_t ParallelDocumentStream::GetOffset() const {
+  return impl_->GetOffset();
+}
+
+void ParallelDocumentStream::ForEach(const Callback& callback) {
+  Value value;
+  DocumentStream::Status status;
+  while ((status = Next(value)) != DocumentStream::Status::kEnd)
+    callback(status, GetOffset(), value);
+}
+
+bool Parser::DeserializeParallel(const char* csonpp_str,
+                                 size_t size,
+                                 Value& value,
+                                 size_t threads,
+                                 size_t max_depth) {
+  auto error_occured = [&value] {
+    value = Value();
+    return false;
+  };
+
+  const char* end = csonpp_str + size;
+  const char* first = csonpp_str;
+  while (first < end && isspace(static_cast<unsigned char>(*first)))
+    ++first;
+  if (size < kParallelMinSize || size >= UINT32_MAX ||
+      first == end || *first != '[')
+    return Deserialize(csonpp_str, size, value, max_depth);
+
+  std::vector<uint32_t> structurals;
+  std::vector<size_t> boundaries;
+  if (!max_depth ||
+      !BuildStructuralIndex(csonpp_str, size, structurals) ||
+      !FindElements(csonpp_str, structurals, boundaries))
+    return error_occured();
+  std::vector<uint32_t>().swap(structurals);
+
+  size_t count = boundaries.size() - 1;
+  if (count == 1) {
+    // [] has no element
+    const char* cur = csonpp_str + boundaries[0] + 1;
+    while (cur < end && isspace(static_cast<unsigned char>(*cur)))
+      ++cur;
+    if (cur == csonpp_str + boundaries[1])
+      count = 0;
+  }
+
+  Array array;
+  array.Resize(count);
+  value = Value(std::move(array));
+  if (!count)
+    return true;
+
+  Value* elements = &value[0];
+  std::atomic<bool> failed(false);
+  {
+    // the pool runs every task before it is destroyed
+    ThreadPool pool(threads);
+    size_t batches = std::min(count, pool.GetThreadCount() * kBatchesPerThread);
+    for (size_t batch = 0; batch < batches; ++batch) {
+      size_t batch_begin = count * batch / batches;
+      size_t batch_end = count * (batch + 1) / batches;
+      pool.Submit([=, &boundaries, &failed] {
+        ParserImpl parser(max_depth - 1);
+        for (size_t i = batch_begin; i < batch_end && !failed; ++i) {
+          size_t begin = boundaries[i] + 1;
+          if (!parser.Deserialize(csonpp_str + begin,
+                                  boundaries[i + 1] - begin,
+                                  elements[i]))
+            failed = true;
+        }
+      });
+    }
+  }
+  if (failed)
+    return error_occured();
+  return true;
+}
+
+}  // namespace csonpp
@@ -0,0 +1,114 @@
+#ifndef CSONPP_PARALLEL_IMPL_H_
+#define CSONPP_PARALLEL_IMPL_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "csonpp_impl.h"
+
+namespace csonpp {
+
+/**
+ * a fixed set of threads, each with its own deque of tasks:
+ * a thread runs the newest task of its own deque first and, once it is
+ * empty, steals the oldest task of another one.
+ * the tasks left when the pool is destroyed are still run.
+ */
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+
+  // 0 threads means one per hardware thread
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool();
+
+  // a task submitted by a task goes to the deque of its own thread,
+  // the others are spread over the deques in turn
+  void Submit(Task task);
+
+  size_t GetThreadCount() const {
+    return threads_.size();
+  }
+
+ private:
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  // guards pending_ and stop_, the idle threads wait on wakeup_
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  size_t pending_;
+  bool stop_;
+  std::atomic<size_t> next_worker_;
+
+  void Run(size_t index);
+  bool PopTask(size_t index, Task& task);
+};
+
+// the documents of one chunk of lines parsed by a task
+struct DocumentChunk {
+  const char* begin;
+  size_t size;
+  size_t offset;
+  std::vector<DocumentStream::Status> statuses;
+  std::vector<size_t> offsets;
+  std::vector<Value> values;
+  bool done;
+};
+
+class ParallelDocumentStreamImpl {
+ public:
+  ParallelDocumentStreamImpl(const char* csonpp_str,
+                             size_t size,
+                             const ParallelDocumentStream::Options& options);
+  ~ParallelDocumentStreamImpl();
+
+  DocumentStream::Status Next(Value& value);
+
+  size_t GetOffset() const {
+    return offset_;
+  }
+
+ private:
+  const char* begin_;
+  const char* cur_;
+  const char* end_;
+  ParallelDocumentStream::Options options_;
+  size_t max_chunks_;
+
+  // guards the done flags of the chunks, signaled when one is done
+  std::mutex mutex_;
+  std::condition_variable chunk_done_;
+  // the chunks submitted and not delivered yet, in the input order
+  std::deque<std::unique_ptr<DocumentChunk>> chunks_;
+  std::unique_ptr<DocumentChunk> current_;
+  size_t next_document_;
+  size_t offset_;
+  std::atomic<bool> stopping_;
+
+  // the last member, it is destroyed first, after the tasks still
+  // referring to the other members are done
+  ThreadPool pool_;
+
+  void SubmitChunks();
+  void ParseChunk(DocumentChunk* chunk);
+};
+
+}  // namespace csonpp
+
+#endif  // CSONPP_PARALLEL_IMPL_H_
@@ -0,0 +1,453 @@
+#include "simd_impl.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef CSONPP_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CSONPP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CSONPP_TARGET(isa)
+#endif
+
+namespace csonpp {
+
+namespace {
+
+/**
+ * one bit per byte of a 64-byte block, bit i stands for block[i]
+ */
+struct BlockMasks {
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t op;          // { } [ ] : ,
+  uint64_t whitespace;  // the same set as isspace()
+};
+
+typedef void (*ClassifyFunc)(const char* block, BlockMasks& masks);
+
+inline int CountTrailingZeros(uint64_t mask) {
+  assert(mask);
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return static_cast<int>(index);
+#else
+  int n = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+enum CharClass {
+  kQuote      = 1,
+  kBackslash  = 2,
+  kOp         = 4,
+  kWhitespace = 8,
+};
+
+struct CharClassTable {
+  uint8_t value[256];
+
+  CharClassTable() {
+    memset(value, 0, sizeof(value));
+    value[static_cast<uint8_t>('\"')] = kQuote;
+    value[static_cast<uint8_t>('\\')] = kBackslash;
+    value[static_cast<uint8_t>('{')] = kOp;
+    value[static_cast<uint8_t>('}')] = kOp;
+    value[static_cast<uint8_t>('[')] = kOp;
+    value[static_cast<uint8_t>(']')] = kOp;
+    value[static_cast<uint8_t>(':')] = kOp;
+    value[static_cast<uint8_t>(',')] = kOp;
+    value[static_cast<uint8_t>(' ')] = kWhitespace;
+    for (int c = '\t'; c <= '\r'; ++c)
+      value[c] = kWhitespace;
+  }
+};
+
+const CharClassTable kCharClassTable;
+
+void ClassifyScalar(const char* block, BlockMasks& masks) {
+  masks.quote = masks.backslash = masks.op = masks.whitespace = 0;
+  for (int i = 0; i < 64; ++i) {
+    uint64_t bit = 1ULL << i;
+    switch (kCharClassTable.value[static_cast<uint8_t>(block[i])]) {
+    case kQuote:      masks.quote |= bit;      break;
+    case kBackslash:  masks.backslash |= bit;  break;
+    case kOp:         masks.op |= bit;         break;
+    case kWhitespace: masks.whitespace |= bit; break;
+    default: break;
+    }
+  }
+}
+
+#ifdef CSONPP_SIMD_X86
+
+// '[' and ']' differ from '{' and '}' only in the 0x20 bit, so both pairs
+// are matched by a single compare after or-ing that bit in.
+
+CSONPP_TARGET("sse4.2")
+void ClassifySse42(const char* block, BlockMasks& masks) {
+  const __m128i quote = _mm_set1_epi8('\"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i lower_bit = _mm_set1_epi8(0x20);
+  const __m128i left = _mm_set1_epi8('{');
+  const __m128i right = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+
+  masks.quote = masks.backslash = masks.op = masks.whitespace = 0;
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+    __m128i lowered = _mm_or_si128(v, lower_bit);
+    __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(lowered, left), _mm_cmpeq_epi8(lowered, right)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    __m128i ws = _mm_or_si128(
+        _mm_cmpeq_epi8(v, space),
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, tab), v),
+                      _mm_cmpeq_epi8(_mm_min_epu8(v, cr), v)));
+    int shift = 16 * i;
+    masks.quote |= static_cast<uint64_t>(static_cast<uint16_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << shift;
+    masks.backslash |= static_cast<uint64_t>(static_cast<uint16_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)))) << shift;
+    masks.op |= static_cast<uint64_t>(static_cast<uint16_t>(
+        _mm_movemask_epi8(op))) << shift;
+    masks.whitespace |= static_cast<uint64_t>(static_cast<uint16_t>(
+        _mm_movemask_epi8(ws))) << shift;
+  }
+}
+
+CSONPP_TARGET("avx2")
+void ClassifyAvx2(const char* block, BlockMasks& masks) {
+  const __m256i quote = _mm256_set1_epi8('\"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i lower_bit = _mm256_set1_epi8(0x20);
+  const __m256i left = _mm256_set1_epi8('{');
+  const __m256i right = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i cr = _mm256_set1_epi8('\r');
+
+  masks.quote = masks.backslash = masks.op = masks.whitespace = 0;
+  for (int i = 0; i < 2; ++i) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+    __m256i lowered = _mm256_or_si256(v, lower_bit);
+    __m256i op = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(lowered, left),
+                        _mm256_cmpeq_epi8(lowered, right)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                        _mm256_cmpeq_epi8(v, comma)));
+    __m256i ws = _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, space),
+        _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, tab), v),
+                         _mm256_cmpeq_epi8(_mm256_min_epu8(v, cr), v)));
+    int shift = 32 * i;
+    masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)))) << shift;
+    masks.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)))) << shift;
+    masks.op |= static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm256_movemask_epi8(op))) << shift;
+    masks.whitespace |= static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm256_movemask_epi8(ws))) << shift;
+  }
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CSONPP_HAS_AVX512 1
+
+CSONPP_TARGET("avx512f,avx512bw")
+void ClassifyAvx512(const char* block, BlockMasks& masks) {
+  __m512i v = _mm512_loadu_si512(reinterpret_cast<const void*>(block));
+  __m512i lowered = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+  masks.quote = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\"'));
+  masks.backslash = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\\'));
+  masks.op = _mm512_cmpeq_epi8_mask(lowered, _mm512_set1_epi8('{')) |
+             _mm512_cmpeq_epi8_mask(lowered, _mm512_set1_epi8('}')) |
+             _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(':')) |
+             _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(','));
+  masks.whitespace = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(' ')) |
+                     (_mm512_cmpge_epu8_mask(v, _mm512_set1_epi8('\t')) &
+                      _mm512_cmple_epu8_mask(v, _mm512_set1_epi8('\r')));
+}
+#endif
+
+#endif  // CSONPP_SIMD_X86
+
+typedef const char* (*FindFunc)(const char* begin, const char* end);
+
+inline bool IsStringSpecial(char c) {
+  return c == '\"' || c == '\\' || static_cast<uint8_t>(c) < 0x20;
+}
+
+const char* FindStringSpecialScalar(const char* begin, const char* end) {
+  while (begin < end && !IsStringSpecial(*begin))
+    ++begin;
+  return begin;
+}
+
+#ifdef CSONPP_SIMD_X86
+
+CSONPP_TARGET("sse4.2")
+const char* FindStringSpecialSse42(const char* begin, const char* end) {
+  const __m128i quote = _mm_set1_epi8('\"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  for (; end - begin >= 16; begin += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+    int mask = _mm_movemask_epi8(special);
+    if (mask)
+      return begin + CountTrailingZeros(static_cast<uint64_t>(mask));
+  }
+  return FindStringSpecialScalar(begin, end);
+}
+
+CSONPP_TARGET("avx2")
+const char* FindStringSpecialAvx2(const char* begin, const char* end) {
+  const __m256i quote = _mm256_set1_epi8('\"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  for (; end - begin >= 32; begin += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                        _mm256_cmpeq_epi8(v, backslash)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(special));
+    if (mask)
+      return begin + CountTrailingZeros(mask);
+  }
+  return FindStringSpecialSse42(begin, end);
+}
+
+#ifdef CSONPP_HAS_AVX512
+CSONPP_TARGET("avx512f,avx512bw")
+const char* FindStringSpecialAvx512(const char* begin, const char* end) {
+  const __m512i quote = _mm512_set1_epi8('\"');
+  const __m512i backslash = _mm512_set1_epi8('\\');
+  const __m512i control = _mm512_set1_epi8(0x1F);
+  for (; end - begin >= 64; begin += 64) {
+    __m512i v = _mm512_loadu_si512(reinterpret_cast<const void*>(begin));
+    uint64_t mask = _mm512_cmpeq_epi8_mask(v, quote) |
+                    _mm512_cmpeq_epi8_mask(v, backslash) |
+                    _mm512_cmple_epu8_mask(v, control);
+    if (mask)
+      return begin + CountTrailingZeros(mask);
+  }
+  return FindStringSpecialAvx2(begin, end);
+}
+#endif
+
+#endif  // CSONPP_SIMD_X86
+
+FindFunc GetFinder(SimdLevel level) {
+#ifdef CSONPP_SIMD_X86
+  switch (level) {
+#ifdef CSONPP_HAS_AVX512
+  case SimdLevel::kAvx512: return FindStringSpecialAvx512;
+#else
+  case SimdLevel::kAvx512:
+#endif
+  case SimdLevel::kAvx2:   return FindStringSpecialAvx2;
+  case SimdLevel::kSse42:  return FindStringSpecialSse42;
+  default: break;
+  }
+#else
+  (void)level;
+#endif
+  return FindStringSpecialScalar;
+}
+
+ClassifyFunc GetClassifier(SimdLevel level) {
+#ifdef CSONPP_SIMD_X86
+  switch (level) {
+#ifdef CSONPP_HAS_AVX512
+  case SimdLevel::kAvx512: return ClassifyAvx512;
+#else
+  case SimdLevel::kAvx512:
+#endif
+  case SimdLevel::kAvx2:   return ClassifyAvx2;
+  case SimdLevel::kSse42:  return ClassifySse42;
+  default: break;
+  }
+#else
+  (void)level;
+#endif
+  return ClassifyScalar;
+}
+
+/**
+ * bit i of the result is the xor of bits [0, i] of mask,
+ * i.e. it is set for every charactor from an opening quote (inclusive)
+ * to the matching closing quote (exclusive)
+ */
+inline uint64_t PrefixXor(uint64_t mask) {
+  mask ^= mask << 1;
+  mask ^= mask << 2;
+  mask ^= mask << 4;
+  mask ^= mask << 8;
+  mask ^= mask << 16;
+  mask ^= mask << 32;
+  return mask;
+}
+
+/**
+ * the charactors escaped by a backslash, a backslash escaped by the one
+ * before it does not escape the charactor following it.
+ * escapes are rare, so the backslashes are simply walked one by one.
+ * @param carry  in: the first charactor is escaped by the previous block
+ *               out: the last charactor of this block is an escaping backslash
+ */
+inline uint64_t FindEscaped(uint64_t backslash, uint64_t& carry) {
+  if (!backslash && !carry)
+    return 0;
+  uint64_t escaped = 0;
+  if (carry) {
+    escaped |= 1;
+    backslash &= ~1ULL;
+  }
+  carry = 0;
+  while (backslash) {
+    int i = CountTrailingZeros(backslash);
+    if (i == 63) {
+      carry = 1;
+      break;
+    }
+    escaped |= 1ULL << (i + 1);
+    backslash &= ~(3ULL << i);
+  }
+  return escaped;
+}
+
+}  // namespace
+
+SimdLevel DetectSimdLevel() {
+  static const SimdLevel level = [] {
+#if defined(CSONPP_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+#ifdef CSONPP_HAS_AVX512
+    if (__builtin_cpu_supports("avx512bw"))
+      return SimdLevel::kAvx512;
+#endif
+    if (__builtin_cpu_supports("avx2"))
+      return SimdLevel::kAvx2;
+    if (__builtin_cpu_supports("sse4.2"))
+      return SimdLevel::kSse42;
+#elif defined(CSONPP_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool os_avx = (info[2] & (1 << 27)) != 0 &&  // osxsave
+                  (_xgetbv(0) & 0x6) == 0x6;
+    if (os_avx && max_leaf >= 7) {
+      __cpuidex(info, 7, 0);
+      if (info[1] & (1 << 5))
+        return SimdLevel::kAvx2;
+    }
+    if (sse42)
+      return SimdLevel::kSse42;
+#endif
+    return SimdLevel::kScalar;
+  }();
+  return level;
+}
+
+namespace detail {
+
+const char* FindStringSpecial(const char* begin, const char* end) {
+  static const FindFunc find = GetFinder(DetectSimdLevel());
+  return find(begin, end);
+}
+
+const char* FindStringSpecial(const char* begin,
+                              const char* end,
+                              SimdLevel level) {
+  return GetFinder(level)(begin, end);
+}
+
+}  // namespace detail
+
+size_t IndexBlocks(const char* csonpp_str,
+                   size_t size,
+                   detail::IndexState& state,
+                   uint32_t* positions,
+                   size_t capacity,
+                   SimdLevel level) {
+  assert(size < UINT32_MAX);
+  ClassifyFunc classify = GetClassifier(level);
+  uint32_t* out = positions;
+  uint32_t* out_end = positions + capacity;
+
+  for (; state.base < size && out_end - out >= 64; state.base += 64) {
+    size_t base = state.base;
+    BlockMasks masks;
+    if (size - base >= 64) {
+      classify(csonpp_str + base, masks);
+    } else {
+      // pad the tail with whitespaces, they never produce a position
+      char block[64];
+      memset(block, ' ', sizeof(block));
+      memcpy(block, csonpp_str + base, size - base);
+      classify(block, masks);
+    }
+
+    uint64_t escaped = FindEscaped(masks.backslash, state.escaped);
+    uint64_t quote = masks.quote & ~escaped;
+    uint64_t in_string = PrefixXor(quote) ^ state.in_string;
+    state.in_string = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+
+    uint64_t scalar = ~(masks.op | masks.whitespace | quote) & ~in_string;
+    uint64_t scalar_start = scalar & ~((scalar << 1) | state.scalar);
+    state.scalar = scalar >> 63;
+
+    uint64_t structurals = (masks.op & ~in_string) | (quote & in_string) | scalar_start;
+    while (structurals) {
+      *out++ = static_cast<uint32_t>(base + CountTrailingZeros(structurals));
+      structurals &= structurals - 1;
+    }
+  }
+  return out - positions;
+}
+
+bool BuildStructuralIndex(const char* csonpp_str,
+                          size_t size,
+                          std::vector<uint32_t>& positions,
+                          SimdLevel level) {
+  detail::IndexState state;
+  size_t count = 0;
+  positions.clear();
+  while (state.base < size) {
+    if (positions.size() < count + 64)
+      positions.resize(std::max(positions.size() * 2, count + 64));
+    count += IndexBlocks(csonpp_str, size, state, &positions[count], 
+                         positions.size() - count, level);
+  }
+  positions.resize(count);
+  return !state.in_string;
+}
+
+}  // namespace csonpp
@@ -0,0 +1,84 @@
+#ifndef CSONPP_SIMD_IMPL_H_
+#define CSONPP_SIMD_IMPL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "../csonpp_detail.h"
+
+#if !defined(CSONPP_NO_SIMD) && \
+    (defined(__x86_64__) || defined(__i386__) || \
+     defined(_M_X64) || defined(_M_IX86))
+#define CSONPP_SIMD_X86 1
+#endif
+
+namespace csonpp {
+
+/**
+ * the instruction sets the vectorized scanners are built for,
+ * ordered from the slowest to the fastest
+ */
+enum class SimdLevel {
+  kScalar = 0,
+  kSse42  = 1,
+  kAvx2   = 2,
+  kAvx512 = 3,
+};
+
+/**
+ * the best level supported both by the compiler and by the running cpu,
+ * detected once and cached
+ */
+SimdLevel DetectSimdLevel();
+
+/**
+ * stage 1 of the parser:
+ * classify the input 64 bytes at a time and record the position of every
+ * structural charactor, i.e. every one of '{' '}' '[' ']' ':' ',' outside of
+ * a string, every opening '"' and the first charactor of every other scalar
+ * (true, false, null, numbers) outside of a string.
+ * whitespaces, string bodies and closing quotes never appear in the index.
+ * @param csonpp_str  the input, not necessarily '\0' terminated
+ * @param size        the size of the input, must be less than 4G
+ * @param positions   filled with the ascending positions
+ * @param level       the instruction set used to classify the input
+ * @return false if the input ends inside a string
+ */
+bool BuildStructuralIndex(const char* csonpp_str,
+                          size_t size,
+                          std::vector<uint32_t>& positions,
+                          SimdLevel level = DetectSimdLevel());
+
+/**
+ * the same, a few blocks at a time: the blocks from state.base on are
+ * classified as long as their positions fit in capacity, which must hold
+ * 64 at least, and state is left where they stop.
+ * @return the number of positions written, 0 once the input is indexed,
+ *         state.in_string is then set if the input ends inside a string
+ */
+size_t IndexBlocks(const char* csonpp_str,
+                   size_t size,
+                   detail::IndexState& state,
+                   uint32_t* positions,
+                   size_t capacity,
+                   SimdLevel level = DetectSimdLevel());
+
+namespace detail {
+
+/**
+ * find the end of the run of plain charactors in a string body
+ * @return the first '"', '\\' or control charactor (< 0x20) in [begin, end),
+ *         end if there is none
+ */
+const char* FindStringSpecial(const char* begin, const char* end);
+
+const char* FindStringSpecial(const char* begin,
+                              const char* end,
+                              SimdLevel level);
+
+}  // namespace detail
+
+}  // namespace csonpp
+
+#endif  // CSONPP_SIMD_IMPL_H_
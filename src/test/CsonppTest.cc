@@ -1,5 +1,12 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sstream>
+#include <thread>
+
 #include "gtest/gtest.h"
 #include "csonpp.h"
+#include "private/simd_impl.h"
 
 TEST(CsonppTest, DeSerializeToObject) {
   std::string str1("{}");
@@ -89,6 +96,28 @@ TEST(CsonppTest, DeSerializeToArray) {
   ASSERT_EQ(value3[4][3].AsString(), "12");
 }
 
+TEST(CsonppTest, DeserializeFromBuffer) {
+  // no '\0' terminator, the parser must stop at the explicit end
+  const char buf1[] = {'[', '1', ',', '2', ']', 'x', 'x'};
+  csonpp::Value value1 = csonpp::Parser::Deserialize(buf1, 5);
+  ASSERT_EQ(value1.GetType(), csonpp::Value::Type::kArray);
+  ASSERT_EQ(value1.Size(), 2);
+  ASSERT_EQ(value1[0].AsInteger(), 1);
+  ASSERT_EQ(value1[1].AsInteger(), 2);
+
+  const char buf2[] = {'1', '2', '3', '4'};
+  csonpp::Value value2 = csonpp::Parser::Deserialize(buf2, 2);
+  ASSERT_EQ(value2.GetType(), csonpp::Value::Type::kInteger);
+  ASSERT_EQ(value2.AsInteger(), 12);
+
+  const char buf3[] = {'\"', 'a', 'b', '\"'};
+  csonpp::Value value3 = csonpp::Parser::Deserialize(buf3, 3);
+  ASSERT_EQ(value3.GetType(), csonpp::Value::Type::kDummy);
+
+  csonpp::Value value4 = csonpp::Parser::Deserialize(buf3, 0);
+  ASSERT_EQ(value4.GetType(), csonpp::Value::Type::kDummy);
+}
+
 TEST(CsonppTest, DeserializeUnicodeString) {
   std::string str1("[3.1456, 1., 2, \"a\\u0062\", { \"a\\u5066a\" : { \"12\\uD800\\uDC00\" :   \t1.2e-2}\t}, true, false, null]");
   csonpp::Value value1 = csonpp::Parser::Deserialize(str1);
@@ -118,7 +147,7 @@ TEST(CsonppTest, Serialize) {
   csonpp::Value value2 = csonpp::Parser::Deserialize(str2);
   ASSERT_EQ(value2.GetType(), csonpp::Value::Type::kDouble);
   ASSERT_DOUBLE_EQ(value2.AsDouble(), -0.012);
-  ASSERT_EQ(csonpp::Parser::Serialize(value2), "-0.0120");
+  ASSERT_EQ(csonpp::Parser::Serialize(value2), "-0.012");
 
   std::string str3 = "1234567";
   csonpp::Value value3 = csonpp::Parser::Deserialize(str3);
@@ -130,16 +159,16 @@ TEST(CsonppTest, Serialize) {
   csonpp::Value value4 = csonpp::Parser::Deserialize(str4);
   ASSERT_EQ(value4.GetType(), csonpp::Value::Type::kDouble);
   ASSERT_DOUBLE_EQ(value4.AsDouble(), -1234567.50);
-  ASSERT_EQ(csonpp::Parser::Serialize(value4), "-1234567.50");
+  ASSERT_EQ(csonpp::Parser::Serialize(value4), "-1234567.5");
 
   std::string str5 = "{\"a\":   \t-1234567.50}";
   csonpp::Value value5 = csonpp::Parser::Deserialize(str5);
   ASSERT_EQ(value5.GetType(), csonpp::Value::Type::kObject);
-  ASSERT_EQ(csonpp::Parser::Serialize(value5), "{\"a\":-1234567.50}");
+  ASSERT_EQ(csonpp::Parser::Serialize(value5), "{\"a\":-1234567.5}");
 
   std::string str6("[3.1456, 1., 2, \"a\\u0062\", { \"a\\u5066a\" : { \"12\\uD800\\uDC00\" :   \t1.2e-2}\t}, true, false, null]");
   csonpp::Value value6 = csonpp::Parser::Deserialize(str6);
-  ASSERT_EQ(csonpp::Parser::Serialize(value6), "[3.14560,1.0,2,\"ab\",{\"a\\u5066a\":{\"12\\uD800\\uDC00\":0.0120}},true,false,null]");
+  ASSERT_EQ(csonpp::Parser::Serialize(value6), "[3.1456,1.0,2,\"ab\",{\"a\\u5066a\":{\"12\\uD800\\uDC00\":0.012}},true,false,null]");
 
   std::string str7("[12,false, false  , null , [12e4,32, [], \"12\"]]");
   csonpp::Value value7 = csonpp::Parser::Deserialize(str7);
@@ -147,3 +176,1106 @@ TEST(CsonppTest, Serialize) {
   ASSERT_EQ(csonpp::Parser::Serialize(value7), "[12,false,false,null,[120000.0,32,[],\"12\"]]");
 }
 
+
+TEST(CsonppTest, StructuralIndex) {
+  std::string str1("{ \"a\\\"b\\\\\" : [true, -12.5e3,null], \"c\":\"{[,:]}\" }");
+  std::vector<uint32_t> positions;
+  ASSERT_TRUE(csonpp::BuildStructuralIndex(str1.data(), str1.size(), positions,
+                                           csonpp::SimdLevel::kScalar));
+  std::vector<uint32_t> expected = {0, 2, 11, 13, 14, 18, 20, 27, 28, 32, 33, 35, 38, 39, 48};
+  ASSERT_EQ(positions, expected);
+
+  // every level must agree with the scalar one, escapes and strings
+  // crossing the 64-byte blocks included
+  std::string str2;
+  for (int i = 0; i < 200; ++i) {
+    str2.append(std::string(i % 7, ' '));
+    str2.append("{\"k\":\"");
+    str2.append(std::string(i % 67, 'x'));
+    str2.append(std::string(i % 5, '\\'));
+    str2.append((i % 5) % 2 ? "\"\"" : "\"");
+    str2.append(",\"n\":[1,2.5,false]},");
+  }
+  std::vector<uint32_t> scalar_positions;
+  ASSERT_TRUE(csonpp::BuildStructuralIndex(str2.data(), str2.size(), scalar_positions,
+                                           csonpp::SimdLevel::kScalar));
+  for (int level = 1; level <= static_cast<int>(csonpp::DetectSimdLevel()); ++level) {
+    ASSERT_TRUE(csonpp::BuildStructuralIndex(str2.data(), str2.size(), positions,
+                                             static_cast<csonpp::SimdLevel>(level)));
+    ASSERT_EQ(positions, scalar_positions);
+  }
+
+  std::string str3("[\"abc\\\"]");
+  ASSERT_FALSE(csonpp::BuildStructuralIndex(str3.data(), str3.size(), positions));
+
+  // Deserialize() walks the index and must agree with the push parser,
+  // which scans serially, where a scalar and the index disagree
+  const char* cases[] = {"[1x]", "[truex]", "[nullx, 1]", "[1\f]", "\f[\v1\f]\f", "[1 2]",
+                         "[\"a\"\"b\"]", "{\"a\"1}", "[1:2]", "[1\x01]", "\"abc", "   "};
+  for (const char* str : cases) {
+    csonpp::Value indexed, serial;
+    csonpp::PushParser parser;
+    bool ok = parser.Feed(str, strlen(str)) && parser.Finish(serial);
+    ASSERT_EQ(csonpp::Parser::Deserialize(str, strlen(str), indexed), ok) << str;
+    if (ok) {
+      ASSERT_TRUE(indexed == serial) << str;
+    }
+  }
+
+  // long inputs refill the index many times
+  std::string str4("[");
+  for (int i = 0; i < 20000; ++i)
+    str4.append("\n  {\"id\" : \"abc\\\" ,\",\t\"v\": [1,\r\n true ] } ,");
+  str4.append("\n  null ]");
+  csonpp::Value value4 = csonpp::Parser::Deserialize(str4);
+  ASSERT_EQ(value4.GetType(), csonpp::Value::Type::kArray);
+  ASSERT_EQ(value4.Size(), 20001);
+  ASSERT_EQ(value4[19999]["id"].AsString(), "abc\" ,");
+  ASSERT_TRUE(value4[19999]["v"][1].AsBool());
+  ASSERT_EQ(value4[20000].GetType(), csonpp::Value::Type::kNull);
+
+  str4.replace(str4.size() - 2, 1, "\"");
+  csonpp::Value value5 = csonpp::Parser::Deserialize(str4);
+  ASSERT_EQ(value5.GetType(), csonpp::Value::Type::kDummy);
+}
+
+TEST(CsonppTest, StringRun) {
+  std::string str1(200, 'a');
+  str1[130] = '\\';
+  str1[150] = '\"';
+  str1[170] = '\x1F';
+  str1[180] = '\x80';
+  for (int level = 0; level <= static_cast<int>(csonpp::DetectSimdLevel()); ++level) {
+    csonpp::SimdLevel simd_level = static_cast<csonpp::SimdLevel>(level);
+    const char* begin = str1.data();
+    const char* end = str1.data() + str1.size();
+    ASSERT_EQ(csonpp::detail::FindStringSpecial(begin, end, simd_level), begin + 130);
+    ASSERT_EQ(csonpp::detail::FindStringSpecial(begin + 131, end, simd_level), begin + 150);
+    ASSERT_EQ(csonpp::detail::FindStringSpecial(begin + 151, end, simd_level), begin + 170);
+    ASSERT_EQ(csonpp::detail::FindStringSpecial(begin + 171, end, simd_level), end);
+    ASSERT_EQ(csonpp::detail::FindStringSpecial(begin + 171, begin + 175, simd_level), begin + 175);
+  }
+
+  std::string body;
+  for (int i = 0; i < 100; ++i)
+    body.append(std::string(i, 'x')).append("\\n\\u00e9\t");
+  csonpp::Value value2 = csonpp::Parser::Deserialize("[\"" + body + "\"]");
+  ASSERT_EQ(value2.GetType(), csonpp::Value::Type::kArray);
+  std::string expected;
+  for (int i = 0; i < 100; ++i)
+    expected.append(std::string(i, 'x')).append("\n\xC3\xA9\t");
+  ASSERT_EQ(value2[0].AsString(), expected);
+}
+
+TEST(CsonppTest, DeserializeInteger) {
+  ASSERT_EQ(csonpp::Parser::Deserialize("0").AsInteger(), 0);
+  ASSERT_EQ(csonpp::Parser::Deserialize("-0").AsInteger(), 0);
+  ASSERT_EQ(csonpp::Parser::Deserialize("12345678").AsInteger(), 12345678);
+  ASSERT_EQ(csonpp::Parser::Deserialize("-1234567890123").AsInteger(), -1234567890123LL);
+  ASSERT_EQ(csonpp::Parser::Deserialize("9223372036854775807").AsInteger(), INT64_MAX);
+  ASSERT_EQ(csonpp::Parser::Deserialize("-9223372036854775808").AsInteger(), INT64_MIN);
+  ASSERT_EQ(csonpp::Parser::Deserialize("9223372036854775808").GetType(), 
+            csonpp::Value::Type::kDummy);
+  ASSERT_EQ(csonpp::Parser::Deserialize("-9223372036854775809").GetType(), 
+            csonpp::Value::Type::kDummy);
+  ASSERT_EQ(csonpp::Parser::Deserialize("18446744073709551616").GetType(), 
+            csonpp::Value::Type::kDummy);
+  ASSERT_EQ(csonpp::Parser::Deserialize("99999999999999999999").GetType(), 
+            csonpp::Value::Type::kDummy);
+
+  csonpp::Value value1 = csonpp::Parser::Deserialize("[1,22,333,4444,55555,666666,7777777,88888888,999999999]");
+  ASSERT_EQ(value1.Size(), 9);
+  ASSERT_EQ(value1[7].AsInteger(), 88888888);
+  ASSERT_EQ(value1[8].AsInteger(), 999999999);
+}
+
+TEST(CsonppTest, DeserializeDouble) {
+  csonpp::Value value1 = csonpp::Parser::Deserialize(
+      "[0.1, -2.5e-3, 1.7976931348623157e308, 4.9e-324, 2.2250738585072014e-308,"
+      "9007199254740993.0, 3.14159265358979323846264338327950288, 1e-400, -0.0,"
+      "0.30000000000000000000000000000000000000000000000000000000000000000000001]");
+  ASSERT_EQ(value1.GetType(), csonpp::Value::Type::kArray);
+  ASSERT_EQ(value1.Size(), 10);
+  ASSERT_EQ(value1[0].GetDouble(), 0.1);
+  ASSERT_EQ(value1[1].GetDouble(), -2.5e-3);
+  ASSERT_EQ(value1[2].GetDouble(), 1.7976931348623157e308);
+  ASSERT_EQ(value1[3].GetDouble(), 4.9e-324);
+  ASSERT_EQ(value1[4].GetDouble(), 2.2250738585072014e-308);
+  ASSERT_EQ(value1[5].GetDouble(), 9007199254740992.0);
+  ASSERT_EQ(value1[6].GetDouble(), 3.141592653589793);
+  ASSERT_EQ(value1[7].GetDouble(), 0.0);
+  ASSERT_EQ(value1[8].GetDouble(), 0.0);
+  ASSERT_EQ(value1[9].GetDouble(), 0.3);
+
+  // overflows a double
+  csonpp::Value value2 = csonpp::Parser::Deserialize("1.8e308");
+  ASSERT_EQ(value2.GetType(), csonpp::Value::Type::kDummy);
+}
+
+TEST(CsonppTest, SerializeDouble) {
+  const double nums[] = {0.1, 0.3, -2.5e-3, 1e20, 1e-7, 123456789012345.0, 
+                         1.7976931348623157e308, 4.9e-324, 2.2250738585072014e-308,
+                         1.0 / 3, 100.0, -0.0};
+  const char* texts[] = {"0.1", "0.3", "-0.0025", "1e+20", "1e-7", "123456789012345.0",
+                         "1.7976931348623157e+308", "5e-324", "2.2250738585072014e-308",
+                         "0.3333333333333333", "100.0", "-0.0"};
+  for (size_t i = 0; i < sizeof(nums) / sizeof(nums[0]); ++i) {
+    std::string str = csonpp::Parser::Serialize(csonpp::Value(nums[i]));
+    ASSERT_EQ(str, texts[i]);
+    csonpp::Value value = csonpp::Parser::Deserialize(str);
+    ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDouble);
+    ASSERT_EQ(value.GetDouble(), nums[i]);
+  }
+}
+
+TEST(CsonppTest, SerializeInteger) {
+  const int64_t nums[] = {0, 7, -7, 10, 99, 100, -12345678, 123456789,
+                          1000000000000000000LL, 9223372036854775807LL,
+                          -9223372036854775807LL - 1};
+  const char* texts[] = {"0", "7", "-7", "10", "99", "100", "-12345678", "123456789",
+                         "1000000000000000000", "9223372036854775807",
+                         "-9223372036854775808"};
+  for (size_t i = 0; i < sizeof(nums) / sizeof(nums[0]); ++i) {
+    std::string str = csonpp::Parser::Serialize(csonpp::Value(nums[i]));
+    ASSERT_EQ(str, texts[i]);
+  }
+  csonpp::Value value(csonpp::Value::Type::kArray);
+  value.Append(csonpp::Value(-1));
+  value.Append(csonpp::Value(20));
+  ASSERT_EQ(csonpp::Parser::Serialize(value), "[-1,20]");
+}
+
+TEST(CsonppTest, DeserializeNesting) {
+  // no recursion per element
+  std::string str = "[";
+  for (int i = 0; i < 200000; ++i)
+    str += "{\"a\":[1 , 2.5 ]},";
+  str += "null]";
+  csonpp::Value value;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, value));
+  ASSERT_EQ(value.Size(), 200001);
+  ASSERT_EQ(value[199999]["a"][1].GetDouble(), 2.5);
+
+  // nor per level
+  std::string deep = std::string(100000, '[') + std::string(100000, ']');
+  ASSERT_FALSE(csonpp::Parser::Deserialize(deep, value));
+  ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  ASSERT_TRUE(csonpp::Parser::Deserialize(deep, value, 100000));
+  ASSERT_EQ(csonpp::Parser::Serialize(value), deep);
+
+  std::string limit(csonpp::Parser::kDefaultMaxDepth, '[');
+  limit += std::string(csonpp::Parser::kDefaultMaxDepth, ']');
+  ASSERT_TRUE(csonpp::Parser::Deserialize(limit, value));
+  ASSERT_FALSE(csonpp::Parser::Deserialize("[" + limit + "]", value));
+  ASSERT_FALSE(csonpp::Parser::Deserialize("{\"a\":{\"b\":[]}}", value, 2));
+  ASSERT_TRUE(csonpp::Parser::Deserialize("{\"a\":{\"b\":[]}}", value, 3));
+
+  const char* invalids[] = {"[1,]", "{\"a\":1,}", "[,1]", "{,}", "[1 2]", 
+                            "{\"a\" 1}", "{\"a\":1]", "[1}", "[[1]", "[1]]",
+                            "{} {}", "1 x", "{1:2}", "[", ""};
+  for (size_t i = 0; i < sizeof(invalids) / sizeof(invalids[0]); ++i)
+    ASSERT_FALSE(csonpp::Parser::Deserialize(invalids[i], value)) << invalids[i];
+
+  ASSERT_TRUE(csonpp::Parser::Deserialize(" { \"a\" : [ 1 , -2e3 , 0 ] , \"a\" : 7 } \n", value));
+  ASSERT_EQ(csonpp::Parser::Serialize(value), "{\"a\":7}");
+}
+
+TEST(CsonppTest, DeserializeString) {
+  csonpp::Value value;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(
+      "{\"k\\u0065y\":\"a\\/b\\\\c\\\"d\\n\",\"long key of more than fifteen bytes\":[\"x\",\"\"]}", 
+      value));
+  ASSERT_EQ(value["key"].GetString(), "a/b\\c\"d\n");
+  ASSERT_EQ(value["long key of more than fifteen bytes"][0].GetString(), "x");
+  ASSERT_EQ(value["long key of more than fifteen bytes"][1].GetString(), "");
+  ASSERT_FALSE(csonpp::Parser::Deserialize("{\"a\\x\":1}", value));
+  ASSERT_FALSE(csonpp::Parser::Deserialize("[\"abc", value));
+  ASSERT_FALSE(csonpp::Parser::Deserialize("{\"abc", value));
+}
+
+TEST(CsonppTest, DeserializeInSitu) {
+  std::string str = "{\"a\":\"plain\",\"b\\n\":[\"x\\ty\\u5066\\uD800\\uDC00z\",\"\",\"\\\"\"],"
+                    "\"c\":{\"d\":\"tail\\\\\"}}";
+  csonpp::Value expected;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, expected));
+
+  std::vector<char> buffer(str.begin(), str.end());
+  csonpp::Value value;
+  ASSERT_TRUE(csonpp::Parser::DeserializeInSitu(buffer.data(), buffer.size(), value));
+  ASSERT_TRUE(value == expected);
+  ASSERT_EQ(csonpp::Parser::Serialize(value), csonpp::Parser::Serialize(expected));
+
+  // the strings are decoded in the buffer itself
+  const csonpp::Value& plain = value["a"];
+  ASSERT_EQ(plain.GetStringData(), buffer.data() + 6);
+  ASSERT_EQ(plain.GetStringSize(), 5);
+  ASSERT_EQ(std::string(plain.GetStringData()), "plain");
+  const csonpp::Value& escaped = value["b\n"][0];
+  ASSERT_TRUE(escaped.GetStringData() >= buffer.data() && 
+              escaped.GetStringData() < buffer.data() + buffer.size());
+  ASSERT_EQ(escaped.AsString(), "x\ty\xE5\x81\xA6\xF0\x90\x80\x80z");
+  ASSERT_EQ(value["b\n"][2].AsString(), "\"");
+  ASSERT_EQ(value["c"]["d"].AsString(), "tail\\");
+
+  // a copy still refers to the buffer, AsString() copies it out
+  csonpp::Value copy = value["a"];
+  ASSERT_TRUE(copy.IsBorrowedString());
+  ASSERT_EQ(copy.GetStringData(), plain.GetStringData());
+  ASSERT_EQ(copy.AsString(), "plain");
+  ASSERT_EQ(copy.GetStringData(), plain.GetStringData());
+  copy = std::string("owned");
+  ASSERT_FALSE(copy.IsBorrowedString());
+  ASSERT_EQ(copy.GetStringSize(), 5);
+  ASSERT_EQ(copy.GetString(), "owned");
+  ASSERT_EQ(&copy.GetString(), &copy.GetString());
+
+  std::string invalid = "[\"a\\x\"]";
+  ASSERT_FALSE(csonpp::Parser::DeserializeInSitu(&invalid[0], invalid.size(), value));
+}
+
+TEST(CsonppTest, OnDemand) {
+  std::string str = " {\"user\": {\"id\": 42, \"name\": \"a\\\"b\", \"tags\": [\"x\", {\"]\": \"}\"}]},"
+                    " \"items\": [ {\"sku\": \"s1\", \"price\": 1.5}, {\"sku\": \"s2\", \"price\": -2e3} ],"
+                    " \"k\\u0065y\": true, \"none\": null, \"flag\": false } ";
+  csonpp::OnDemandDocument doc(str);
+  ASSERT_EQ(doc.GetRoot().GetType(), csonpp::Value::Type::kObject);
+  ASSERT_EQ(doc.GetRoot().Size(), 5);
+
+  int64_t id = 0;
+  ASSERT_TRUE(doc["user"]["id"].GetInteger(id));
+  ASSERT_EQ(id, 42);
+  std::string name;
+  ASSERT_TRUE(doc["user"]["name"].GetString(name));
+  ASSERT_EQ(name, "a\"b");
+
+  // in order, then backwards
+  csonpp::OnDemandValue items = doc["items"];
+  ASSERT_EQ(items.Size(), 2);
+  std::string sku;
+  ASSERT_TRUE(items[0]["sku"].GetString(sku));
+  ASSERT_EQ(sku, "s1");
+  double price = 0;
+  ASSERT_TRUE(items[1]["price"].GetDouble(price));
+  ASSERT_EQ(price, -2000);
+  ASSERT_TRUE(items[0]["price"].GetDouble(price));
+  ASSERT_EQ(price, 1.5);
+  ASSERT_EQ(items[2].GetType(), csonpp::Value::Type::kDummy);
+
+  bool boolean = false;
+  ASSERT_TRUE(doc["key"].GetBool(boolean));
+  ASSERT_TRUE(boolean);
+  ASSERT_TRUE(doc["flag"].GetBool(boolean));
+  ASSERT_FALSE(boolean);
+  ASSERT_TRUE(doc["none"].IsNull());
+  ASSERT_TRUE(doc["user"].GetType() == csonpp::Value::Type::kObject);
+  ASSERT_EQ(doc["missing"].GetType(), csonpp::Value::Type::kDummy);
+  ASSERT_FALSE(doc["user"].GetInteger(id));
+  ASSERT_FALSE(doc["missing"]["id"].GetInteger(id));
+
+  csonpp::Value tags;
+  ASSERT_TRUE(doc["user"]["tags"].ToValue(tags));
+  ASSERT_EQ(csonpp::Parser::Serialize(tags), "[\"x\",{\"]\":\"}\"}]");
+
+  csonpp::OnDemandDocument truncated("{\"a\": [1, 2", 11);
+  ASSERT_EQ(truncated["a"].GetType(), csonpp::Value::Type::kDummy);
+}
+
+// writes the events back as compact json
+class EchoHandler {
+ public:
+  std::string out_;
+  int stop_after_ = -1;
+
+  bool Null() { return Write("null"); }
+  bool Bool(bool value) { return Write(value ? "true" : "false"); }
+  bool Int64(int64_t value) { return Write(std::to_string(value)); }
+  bool Double(double value) { 
+    return Write(csonpp::Parser::Serialize(csonpp::Value(value))); 
+  }
+  bool String(const std::string& value) { 
+    return Write(csonpp::Parser::Serialize(csonpp::Value(value))); 
+  }
+  bool Key(const std::string& key) { return String(key) && Raw(":"); }
+  bool StartObject() { return Write("{") && Raw(""); }
+  bool EndObject() { return Raw("}"); }
+  bool StartArray() { return Write("[") && Raw(""); }
+  bool EndArray() { return Raw("]"); }
+
+ private:
+  bool need_comma_ = false;
+
+  bool Write(const std::string& text) {
+    if (need_comma_)
+      out_ += ",";
+    out_ += text;
+    need_comma_ = true;
+    return stop_after_ < 0 || --stop_after_ > 0;
+  }
+  bool Raw(const std::string& text) {
+    out_ += text;
+    need_comma_ = !text.empty() && text != ":";
+    return true;
+  }
+};
+
+TEST(CsonppTest, Parse) {
+  std::string str = " {\"a\": [1, -2.5, \"x\\ny\", true, false, null, {}, []],"
+                    " \"b\": {\"c\": {\"d\": [[]]}}} ";
+  EchoHandler handler;
+  ASSERT_TRUE(csonpp::Parser::Parse(str, handler));
+  ASSERT_EQ(handler.out_, csonpp::Parser::Serialize(csonpp::Parser::Deserialize(str)));
+
+  EchoHandler stopped;
+  stopped.stop_after_ = 5;
+  ASSERT_FALSE(csonpp::Parser::Parse(str, stopped));
+  ASSERT_EQ(stopped.out_, "{\"a\":[1,-2.5");
+
+  const char* invalids[] = {"[1,]", "{\"a\":1,}", "[1 2]", "{\"a\" 1}", "[1}", 
+                            "[1]]", "{} {}", "", "[", "{1:2}"};
+  for (size_t i = 0; i < sizeof(invalids) / sizeof(invalids[0]); ++i) {
+    EchoHandler invalid;
+    ASSERT_FALSE(csonpp::Parser::Parse(invalids[i], invalid)) << invalids[i];
+  }
+  EchoHandler deep;
+  ASSERT_FALSE(csonpp::Parser::Parse("[[[1]]]", deep, 2));
+
+  csonpp::Reader reader(str.data(), str.size());
+  ASSERT_EQ(reader.Next(), csonpp::Reader::Event::kStartObject);
+  ASSERT_EQ(reader.Next(), csonpp::Reader::Event::kKey);
+  ASSERT_EQ(reader.GetString(), "a");
+  ASSERT_EQ(reader.Next(), csonpp::Reader::Event::kStartArray);
+  ASSERT_EQ(reader.Next(), csonpp::Reader::Event::kInteger);
+  ASSERT_EQ(reader.GetInteger(), 1);
+  ASSERT_EQ(reader.Next(), csonpp::Reader::Event::kDouble);
+  ASSERT_EQ(reader.GetDouble(), -2.5);
+}
+
+TEST(CsonppTest, PushParser) {
+  std::string str = " {\"a\\u5066b\": [12345, -0.5e-3, \"x\\\\y\\\"z\\uD800\\uDC00\", true, false, null,"
+                    " {}, [], {\"\": [0]}], \"long\": \"" + std::string(100, 's') + "\"} ";
+  csonpp::Value expected;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, expected));
+
+  csonpp::PushParser parser;
+  for (size_t chunk_size = 1; chunk_size <= str.size(); ++chunk_size) {
+    for (size_t i = 0; i < str.size(); i += chunk_size)
+      ASSERT_TRUE(parser.Feed(str.data() + i, std::min(chunk_size, str.size() - i)));
+    csonpp::Value value;
+    ASSERT_TRUE(parser.Finish(value)) << chunk_size;
+    ASSERT_TRUE(value == expected) << chunk_size;
+  }
+
+  // a scalar ending with the input
+  csonpp::Value value;
+  ASSERT_TRUE(parser.Feed("12", 2));
+  ASSERT_TRUE(parser.Feed("34", 2));
+  ASSERT_TRUE(parser.Finish(value));
+  ASSERT_EQ(value.GetInteger(), 1234);
+
+  const char* invalids[] = {"[1,]", "{\"a\":1,}", "[1 2]", "[1}", "[1]]", "{} {}", 
+                            "", "[", "\"abc", "tru", "truex", "[1x]", "{\"a\"}"};
+  for (size_t i = 0; i < sizeof(invalids) / sizeof(invalids[0]); ++i) {
+    for (size_t j = 0; invalids[i][j]; ++j)
+      parser.Feed(invalids[i] + j, 1);
+    ASSERT_FALSE(parser.Finish(value)) << invalids[i];
+    ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  }
+  ASSERT_FALSE(parser.Feed("[1}", 3));
+  ASSERT_FALSE(parser.Feed("1", 1));
+  parser.Reset();
+  ASSERT_TRUE(parser.Feed("[1]", 3));
+  ASSERT_TRUE(parser.Finish(value));
+
+  csonpp::PushParser shallow(1);
+  ASSERT_FALSE(shallow.Feed("[[", 2));
+}
+
+TEST(CsonppTest, DocumentStream) {
+  std::string str = "{\"a\":1}\n"
+                    "[1,2]\r\n"
+                    "\n"
+                    "  \t\n"
+                    "{\"broken\":}\n"
+                    "\"last\"";
+  csonpp::DocumentStream stream(str);
+  csonpp::Value value;
+  ASSERT_EQ(stream.Next(value), csonpp::DocumentStream::Status::kOk);
+  ASSERT_EQ(value["a"].GetInteger(), 1);
+  ASSERT_EQ(stream.GetLine(), 1);
+  ASSERT_EQ(stream.Next(value), csonpp::DocumentStream::Status::kOk);
+  ASSERT_EQ(value.Size(), 2);
+  ASSERT_EQ(stream.GetOffset(), 8);
+  ASSERT_EQ(stream.Next(value), csonpp::DocumentStream::Status::kError);
+  ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  ASSERT_EQ(stream.GetLine(), 5);
+  ASSERT_EQ(stream.Next(value), csonpp::DocumentStream::Status::kOk);
+  ASSERT_EQ(value.GetString(), "last");
+  ASSERT_EQ(stream.GetLine(), 6);
+  ASSERT_EQ(stream.Next(value), csonpp::DocumentStream::Status::kEnd);
+  ASSERT_EQ(stream.Next(value), csonpp::DocumentStream::Status::kEnd);
+
+  csonpp::DocumentStream empty("", 0);
+  ASSERT_EQ(empty.Next(value), csonpp::DocumentStream::Status::kEnd);
+}
+
+TEST(CsonppTest, ParallelDocumentStream) {
+  std::string str;
+  for (int i = 0; i < 20000; ++i) {
+    if (i % 997 == 0)
+      str += "{\"broken\":\n";
+    else if (i % 101 == 0)
+      str += "\n";
+    else
+      str += "{\"id\":" + std::to_string(i) + ",\"tags\":[\"a\",\"b\"]}\n";
+  }
+
+  std::vector<std::pair<size_t, std::string>> expected;
+  csonpp::DocumentStream stream(str);
+  csonpp::Value value;
+  csonpp::DocumentStream::Status status;
+  while ((status = stream.Next(value)) != csonpp::DocumentStream::Status::kEnd) {
+    expected.push_back(std::make_pair(stream.GetOffset(), 
+        status == csonpp::DocumentStream::Status::kOk ? 
+        csonpp::Parser::Serialize(value) : std::string("error")));
+  }
+
+  csonpp::ParallelDocumentStream::Options options;
+  options.threads = 4;
+  options.chunk_size = 1000;
+  options.max_chunks = 3;
+  for (int ordered = 0; ordered < 2; ++ordered) {
+    options.ordered = (ordered != 0);
+    std::vector<std::pair<size_t, std::string>> results;
+    csonpp::ParallelDocumentStream parallel(str, options);
+    parallel.ForEach([&results] (csonpp::DocumentStream::Status status, 
+                                 size_t offset, 
+                                 csonpp::Value& value) {
+      results.push_back(std::make_pair(offset, 
+          status == csonpp::DocumentStream::Status::kOk ? 
+          csonpp::Parser::Serialize(value) : std::string("error")));
+    });
+    if (!options.ordered)
+      std::sort(results.begin(), results.end());
+    ASSERT_TRUE(results == expected);
+  }
+
+  // dropped before the end
+  csonpp::ParallelDocumentStream dropped(str, options);
+  ASSERT_EQ(dropped.Next(value), csonpp::DocumentStream::Status::kError);
+  ASSERT_EQ(dropped.Next(value), csonpp::DocumentStream::Status::kOk);
+  ASSERT_EQ(value["id"].GetInteger(), 1);
+}
+
+TEST(CsonppTest, DeserializeParallel) {
+  std::string str = " [ ";
+  for (int i = 0; i < 30000; ++i) {
+    str += "{\"id\":" + std::to_string(i) + 
+           ",\"s\":\"a,]\\\"}\",\"v\":[1.5,[{\"x\":null}],true]}, ";
+  }
+  str += "\"last\" ] \n";
+  ASSERT_GT(str.size(), 1u << 20);
+
+  csonpp::Value expected;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, expected));
+  csonpp::Value value;
+  ASSERT_TRUE(csonpp::Parser::DeserializeParallel(str.data(), str.size(), value, 4));
+  ASSERT_EQ(value.Size(), 30001);
+  ASSERT_TRUE(value == expected);
+
+  std::string base = str.substr(0, str.size() - 11);
+  const char* tails[] = {"1,]", "1}", "1] 2", "1]]", "1", "[1]", "{\"a\" 1}]", "1 2]"};
+  for (size_t i = 0; i < sizeof(tails) / sizeof(tails[0]); ++i) {
+    std::string invalid = base + tails[i];
+    ASSERT_FALSE(csonpp::Parser::DeserializeParallel(invalid.data(), invalid.size(), value, 4)) 
+        << tails[i];
+    ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  }
+
+  std::string empty = "[" + std::string(1 << 20, ' ') + "]";
+  ASSERT_TRUE(csonpp::Parser::DeserializeParallel(empty.data(), empty.size(), value));
+  ASSERT_TRUE(value.IsArray());
+  ASSERT_EQ(value.Size(), 0);
+
+  // the depth counts the top-level array
+  ASSERT_FALSE(csonpp::Parser::Deserialize(str, value, 4));
+  ASSERT_FALSE(csonpp::Parser::DeserializeParallel(str.data(), str.size(), value, 4, 4));
+  ASSERT_TRUE(csonpp::Parser::DeserializeParallel(str.data(), str.size(), value, 4, 5));
+
+  // small documents are parsed on the calling thread
+  ASSERT_TRUE(csonpp::Parser::DeserializeParallel("[1,2]", 5, value));
+  ASSERT_EQ(value.Size(), 2);
+  ASSERT_TRUE(csonpp::Parser::DeserializeParallel("{}", 2, value));
+}
+
+TEST(CsonppTest, MappedFile) {
+  std::string path = "/tmp/csonpp_mapped_file_" + std::to_string(getpid()) + ".json";
+  std::string str("{\"abc\":[1,\"x\\ny\"],\"def\":true}");
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file != nullptr);
+  ASSERT_EQ(fwrite(str.data(), 1, str.size(), file), str.size());
+  fclose(file);
+
+  csonpp::Value expected;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, expected));
+  csonpp::Value value;
+  ASSERT_TRUE(csonpp::Parser::DeserializeFile(path, value));
+  ASSERT_TRUE(value == expected);
+
+  // a private writable mapping parsed in place leaves the file untouched
+  {
+    csonpp::MappedFile mapped;
+    ASSERT_TRUE(mapped.Open(path, true));
+    ASSERT_EQ(mapped.GetSize(), str.size());
+    ASSERT_TRUE(csonpp::Parser::DeserializeInSitu(mapped.GetMutableData(), 
+                                                  mapped.GetSize(), 
+                                                  value));
+    ASSERT_TRUE(value == expected);
+  }
+  csonpp::MappedFile mapped;
+  ASSERT_TRUE(mapped.Open(path));
+  ASSERT_TRUE(mapped.GetMutableData() == nullptr);
+  ASSERT_EQ(std::string(mapped.GetData(), mapped.GetSize()), str);
+  csonpp::OnDemandDocument document(mapped.GetData(), mapped.GetSize());
+  bool boolean = false;
+  ASSERT_TRUE(document["def"].GetBool(boolean));
+  ASSERT_TRUE(boolean);
+  mapped.Close();
+  remove(path.c_str());
+
+  ASSERT_FALSE(csonpp::Parser::DeserializeFile(path, value));
+  ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  ASSERT_FALSE(mapped.Open(path));
+}
+
+TEST(CsonppTest, StreamReader) {
+  std::string str = " {\"a\\u5066b\": [12345, -0.5e-3, \"x\\\\y\\\"z\\uD800\\uDC00\", true, false, null,"
+                    " {}, [], {\"\": [0]}], \"long\": \"" + std::string(100, 's') + "\"} ";
+  std::string expected = csonpp::Parser::Serialize(csonpp::Parser::Deserialize(str));
+
+  // every token is cut by the end of the window with some of the sizes
+  for (size_t buffer_size = 1; buffer_size <= 17; ++buffer_size) {
+    std::istringstream stream(str);
+    csonpp::Reader reader(stream, csonpp::Parser::kDefaultMaxDepth, buffer_size);
+    EchoHandler handler;
+    ASSERT_TRUE(csonpp::Parser::Parse(reader, handler)) << buffer_size;
+    ASSERT_EQ(handler.out_, expected) << buffer_size;
+  }
+  std::istringstream stream(str);
+  EchoHandler handler;
+  ASSERT_TRUE(csonpp::Parser::Parse(stream, handler));
+  ASSERT_EQ(handler.out_, expected);
+
+  const char* invalids[] = {"[1,]", "[1 2]", "{\"a\" 1}", "[1]]", "{} {}", 
+                            "", "[", "[\"abc", "[tru", "12a"};
+  for (size_t i = 0; i < sizeof(invalids) / sizeof(invalids[0]); ++i) {
+    std::istringstream invalid_stream(invalids[i]);
+    EchoHandler invalid;
+    ASSERT_FALSE(csonpp::Parser::Parse(invalid_stream, invalid)) << invalids[i];
+  }
+  std::istringstream number_stream("  12345  ");
+  csonpp::Reader number_reader(number_stream, csonpp::Parser::kDefaultMaxDepth, 2);
+  ASSERT_EQ(number_reader.Next(), csonpp::Reader::Event::kInteger);
+  ASSERT_EQ(number_reader.GetInteger(), 12345);
+  ASSERT_EQ(number_reader.Next(), csonpp::Reader::Event::kEnd);
+
+  std::string path = "/tmp/csonpp_stream_reader_" + std::to_string(getpid()) + ".json";
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file != nullptr);
+  ASSERT_EQ(fwrite(str.data(), 1, str.size(), file), str.size());
+  fclose(file);
+  int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  {
+    csonpp::Reader reader(fd, csonpp::Parser::kDefaultMaxDepth, 8);
+    EchoHandler fd_handler;
+    ASSERT_TRUE(csonpp::Parser::Parse(reader, fd_handler));
+    ASSERT_EQ(fd_handler.out_, expected);
+  }
+  close(fd);
+  remove(path.c_str());
+
+  // a pipe is read as the bytes come: a long string arrives in many short
+  // reads, each of them only scans the new bytes
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  std::string long_str = "[\"" + std::string(1 << 18, 'a') + "\\n\", 12345]";
+  std::thread writer([&long_str, &fds] {
+    for (size_t i = 0; i < long_str.size(); i += 7) {
+      ssize_t count = write(fds[1], long_str.data() + i, 
+                            std::min<size_t>(7, long_str.size() - i));
+      (void)count;
+    }
+    close(fds[1]);
+  });
+  bool pipe_ok = false;
+  EchoHandler pipe_handler;
+  {
+    csonpp::Reader reader(fds[0]);
+    pipe_ok = csonpp::Parser::Parse(reader, pipe_handler);
+  }
+  writer.join();
+  close(fds[0]);
+  ASSERT_TRUE(pipe_ok);
+  ASSERT_EQ(pipe_handler.out_, "[\"" + std::string(1 << 18, 'a') + "\\n\",12345]");
+}
+
+TEST(CsonppTest, ParserInstance) {
+  csonpp::Parser parser;
+  csonpp::Value value;
+  for (int i = 0; i < 100; ++i) {
+    std::string str = "{\"id\": " + std::to_string(i) + ", \"tags\": [\"a\", \"b\"]}";
+    ASSERT_TRUE(parser.Load(str, value));
+    ASSERT_EQ(value["id"].AsInteger(), i);
+    ASSERT_EQ(value["tags"].Size(), 2);
+  }
+
+  // a failed document leaves nothing behind for the next one
+  ASSERT_FALSE(parser.Load("{\"a\": [1, 2", value));
+  ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  ASSERT_FALSE(parser.Load("", value));
+  ASSERT_TRUE(parser.Load("[1, 2]", value));
+  ASSERT_EQ(value.Size(), 2);
+
+  std::string large = "[" + std::string(1 << 17, ' ') + "\"x\"]";
+  ASSERT_TRUE(parser.Load(large, value));
+  ASSERT_EQ(value[0].AsString(), "x");
+  ASSERT_TRUE(parser.Load("{\"y\": null}", value));
+  ASSERT_EQ(value["y"].GetType(), csonpp::Value::Type::kNull);
+
+  char insitu[] = "{\"k\": \"v\\n\"}";
+  ASSERT_TRUE(parser.LoadInSitu(insitu, sizeof(insitu) - 1, value));
+  ASSERT_EQ(value["k"].AsString(), "v\n");
+  ASSERT_TRUE(parser.Load("\"copied\"", value));
+  ASSERT_EQ(value.GetString(), "copied");
+
+  csonpp::Parser shallow(2);
+  ASSERT_TRUE(shallow.Load("[[1]]", value));
+  ASSERT_FALSE(shallow.Load("[[[1]]]", value));
+  ASSERT_TRUE(shallow.Load("[[2]]", value));
+}
+
+TEST(CsonppTest, DeserializeFields) {
+  std::string str = "{\"user\": {\"id\": 7, \"name\": \"x\", \"tags\": [1, {\"a\": [2]}]},"
+                    " \"items\": [{\"sku\": \"a\", \"n\": 1}, {\"n\": 2}, {\"sku\": \"c\"}],"
+                    " \"a/b\": {\"~\": true}, \"k\\u0065y\": [[1, 2], [3]], \"skipped\": [}}";
+  csonpp::Value value;
+  // the skipped member is not validated
+  ASSERT_TRUE(csonpp::Parser::DeserializeFields(str, {"/user/id", "/items/*/sku"}, value));
+  ASSERT_EQ(csonpp::Parser::Serialize(value),
+            "{\"user\":{\"id\":7},\"items\":[{\"sku\":\"a\"},{\"sku\":\"c\"}]}");
+
+  ASSERT_TRUE(csonpp::Parser::DeserializeFields(
+      str, {"/a~1b/~0", "/key/0/1", "/user/tags", "/user/tags/1/a"}, value));
+  ASSERT_EQ(csonpp::Parser::Serialize(value),
+            "{\"user\":{\"tags\":[1,{\"a\":[2]}]},\"a/b\":{\"~\":true},\"key\":[[2]]}");
+
+  // a wildcard and a name select from the same member
+  ASSERT_TRUE(csonpp::Parser::DeserializeFields(
+      str, {"/items/0/n", "/items/*/sku"}, value));
+  ASSERT_EQ(csonpp::Parser::Serialize(value),
+            "{\"items\":[{\"sku\":\"a\",\"n\":1},{\"sku\":\"c\"}]}");
+
+  ASSERT_TRUE(csonpp::Parser::DeserializeFields(str, {"/missing", "/user/id/x"}, value));
+  ASSERT_EQ(value.GetType(), csonpp::Value::Type::kNull);
+
+  std::string valid = "{\"a\": [1, {\"b\": 2}], \"c\": 3}";
+  ASSERT_TRUE(csonpp::Parser::DeserializeFields(valid, {""}, value));
+  ASSERT_TRUE(value == csonpp::Parser::Deserialize(valid));
+  ASSERT_TRUE(csonpp::Parser::DeserializeFields(valid, {"/a/1/b"}, value, 3));
+  ASSERT_FALSE(csonpp::Parser::DeserializeFields(valid, {"/a/1/b"}, value, 2));
+  ASSERT_FALSE(csonpp::Parser::DeserializeFields(valid, {"/a"}, value, 1));
+
+  const char* invalid_pointers[] = {"a", "/a~", "/a~2"};
+  for (size_t i = 0; i < sizeof(invalid_pointers) / sizeof(invalid_pointers[0]); ++i) {
+    ASSERT_FALSE(csonpp::Parser::DeserializeFields(valid, {invalid_pointers[i]}, value)) 
+        << invalid_pointers[i];
+    ASSERT_EQ(value.GetType(), csonpp::Value::Type::kDummy);
+  }
+  const char* invalids[] = {"", "{\"a\": [1, 2}", "{\"a\": 1} 2", "{\"a\" 1}", 
+                            "{\"a\": [1,, 2]}", "{\"a\": [1, 2]"};
+  for (size_t i = 0; i < sizeof(invalids) / sizeof(invalids[0]); ++i) {
+    ASSERT_FALSE(csonpp::Parser::DeserializeFields(invalids[i], {"/a/1"}, value)) 
+        << invalids[i];
+  }
+}
+
+TEST(CsonppTest, CompactValue) {
+  ASSERT_LE(sizeof(csonpp::Value), 16);
+
+  csonpp::Value value = csonpp::Parser::Deserialize("{\"a\": [1, \"two\", {\"b\": null}]}");
+  csonpp::Value copy(value);
+  copy["a"][1] = 2.5;
+  ASSERT_EQ(value["a"][1].AsString(), "two");
+  ASSERT_DOUBLE_EQ(copy["a"][1].AsDouble(), 2.5);
+
+  // a moved value is left kDummy, its payload is not shared
+  csonpp::Value moved(std::move(copy));
+  ASSERT_EQ(copy.GetType(), csonpp::Value::Type::kDummy);
+  ASSERT_EQ(moved["a"].Size(), 3);
+
+  // assigning a descendant replaces its ancestor
+  moved = moved["a"];
+  ASSERT_TRUE(moved.IsArray());
+  moved = std::move(moved[2]);
+  ASSERT_TRUE(moved.IsObject());
+  ASSERT_EQ(moved["b"].GetType(), csonpp::Value::Type::kNull);
+  moved = std::string("str");
+  ASSERT_EQ(moved.GetString(), "str");
+  moved = 1;
+  ASSERT_EQ(moved.GetInteger(), 1);
+
+  char insitu[] = "[\"x\", \"y\"]";
+  ASSERT_TRUE(csonpp::Parser::DeserializeInSitu(insitu, sizeof(insitu) - 1, value));
+  copy = value;
+  ASSERT_EQ(copy[0].AsString(), "x");
+  ASSERT_EQ(value[1].GetStringSize(), 1);
+  ASSERT_TRUE(copy == value);
+}
+
+TEST(CsonppTest, Document) {
+  csonpp::Document document(1024);
+  std::string str = "{\"name\": \"a string longer than the small string buffer\", "
+                    "\"list\": [1, 2.5, \"x\", {\"a key longer than the buffer\": [true, null]}]}";
+  const std::string key = "a key longer than the buffer";
+  csonpp::Value copy;
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(csonpp::Parser::Deserialize(str, document));
+    const csonpp::Value& root = document.GetRoot();
+    ASSERT_EQ(root["name"].AsString(), "a string longer than the small string buffer");
+    ASSERT_EQ(root["list"].Size(), 4);
+    ASSERT_DOUBLE_EQ(root["list"][1].GetDouble(), 2.5);
+    ASSERT_EQ(root["list"][2].GetStringSize(), 1);
+    ASSERT_TRUE(root["list"][3][key][0].GetBool());
+    // the keys are in the arena as well, nothing is freed one by one
+    const csonpp::Object& object = root["list"][3].GetObject();
+    ASSERT_EQ(object.Begin()->first.get_allocator().GetArena(), &document.GetArena());
+    ASSERT_EQ(csonpp::Parser::Serialize(root), csonpp::Parser::Serialize(
+        csonpp::Parser::Deserialize(str)));
+
+    // the root is read only, a copy is allocated on the heap
+    copy = root;
+    copy["list"].Append(csonpp::Value(std::string(100, 'y')));
+    copy["extra"] = csonpp::Parser::Deserialize("[\"z\"]");
+  }
+
+  // moving out of the root copies, both outlive the document
+  csonpp::Value moved(std::move(document.GetRoot()["list"]));
+  document.Clear();
+  ASSERT_EQ(copy["list"][2].GetString(), "x");
+  ASSERT_EQ(copy["list"][4].GetStringSize(), 100);
+  ASSERT_EQ(copy["extra"][0].GetString(), "z");
+  ASSERT_EQ(moved[3][key].Size(), 2);
+  ASSERT_TRUE(moved[3].GetObject().Begin()->first.get_allocator().GetArena() == nullptr);
+  ASSERT_EQ(moved[2].GetString(), "x");
+  ASSERT_EQ(document.GetRoot().GetType(), csonpp::Value::Type::kDummy);
+
+  csonpp::Parser parser;
+  std::string large = "[" + std::string(4096, ' ') + "\"" + std::string(2048, 'w') + "\"]";
+  ASSERT_TRUE(parser.Load(large.data(), large.size(), document));
+  ASSERT_EQ(document.GetRoot()[0].GetStringSize(), 2048);
+  ASSERT_FALSE(parser.Load("[1, ", 4, document));
+  ASSERT_EQ(document.GetRoot().GetType(), csonpp::Value::Type::kDummy);
+
+  csonpp::Arena arena(64);
+  for (size_t size = 1; size < 100; ++size) {
+    char* p = static_cast<char*>(arena.Allocate(size, 8));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % 8, 0);
+    memset(p, 0, size);
+  }
+}
+
+namespace {
+
+size_t live_allocations = 0;
+
+template<class T>
+class CountingAllocator {
+ public:
+  typedef T value_type;
+
+  CountingAllocator() {}
+  template<class U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    ++live_allocations;
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t) {
+    --live_allocations;
+    ::operator delete(p);
+  }
+};
+
+template<class T, class U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return true;
+}
+
+template<class T, class U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return false;
+}
+
+typedef csonpp::BasicValue<CountingAllocator<char> > CountedValue;
+
+size_t default_allocations = 0;
+
+// counts its allocations in the counter it is given
+template<class T>
+class StatefulAllocator {
+ public:
+  typedef T value_type;
+
+  StatefulAllocator() : count_(&default_allocations) {}
+  explicit StatefulAllocator(size_t* count) : count_(count) {}
+  template<class U>
+  StatefulAllocator(const StatefulAllocator<U>& other) : count_(other.GetCount()) {}
+
+  T* allocate(size_t n) {
+    ++*count_;
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t) {
+    --*count_;
+    ::operator delete(p);
+  }
+
+  size_t* GetCount() const {
+    return count_;
+  }
+
+ private:
+  size_t* count_;
+};
+
+template<class T, class U>
+bool operator==(const StatefulAllocator<T>& left, const StatefulAllocator<U>& right) {
+  return left.GetCount() == right.GetCount();
+}
+
+template<class T, class U>
+bool operator!=(const StatefulAllocator<T>& left, const StatefulAllocator<U>& right) {
+  return left.GetCount() != right.GetCount();
+}
+
+typedef csonpp::BasicValue<StatefulAllocator<char> > StatefulValue;
+
+}  // namespace
+
+TEST(CsonppTest, BasicValue) {
+  std::string str = "{\"key longer than the small string buffer\": [1, -2.5, true, null, "
+                    "\"a string longer than the small string buffer\", {\"k\": [\"\\u00e9\"]}]}";
+  {
+    CountedValue value;
+    ASSERT_TRUE(csonpp::Parser::Deserialize(str, value));
+    ASSERT_GT(live_allocations, 0);
+    ASSERT_EQ(value.GetType(), csonpp::Value::Type::kObject);
+    CountedValue& list = value["key longer than the small string buffer"];
+    ASSERT_EQ(list.Size(), 6);
+    ASSERT_EQ(list[0].GetInteger(), 1);
+    ASSERT_EQ(list[5]["k"][0].GetStringSize(), 2);
+    ASSERT_EQ(csonpp::Parser::Serialize(value), 
+              csonpp::Parser::Serialize(csonpp::Parser::Deserialize(str)));
+
+    CountedValue copy(value);
+    ASSERT_TRUE(copy == value);
+    copy["added"] = CountedValue(CountedValue::StringType(100, 'x'));
+    ASSERT_EQ(copy.Size(), 2);
+
+    // written and freed without recursing once per level
+    std::string deep = std::string(100000, '[') + std::string(100000, ']');
+    ASSERT_TRUE(csonpp::Parser::Deserialize(deep.data(), deep.size(), copy, 100000));
+    ASSERT_EQ(csonpp::Parser::Serialize(copy), deep);
+
+    ASSERT_FALSE(csonpp::Parser::Deserialize("[1, ", copy));
+    ASSERT_EQ(copy.GetType(), csonpp::Value::Type::kDummy);
+  }
+  ASSERT_EQ(live_allocations, 0);
+
+  // the allocator given to the builder reaches every container and string
+  size_t allocations = 0;
+  {
+    StatefulAllocator<char> alloc(&allocations);
+    StatefulValue value;
+    csonpp::ValueBuilder<StatefulValue> builder(value, alloc);
+    ASSERT_TRUE(csonpp::Parser::Parse(str, builder));
+    ASSERT_GT(allocations, 0);
+    ASSERT_TRUE(value.GetAllocator() == alloc);
+
+    StatefulValue copy(value);
+    ASSERT_TRUE(copy == value);
+    copy["added"] = StatefulValue(StatefulValue::Type::kArray, copy.GetAllocator());
+    copy["added"].Append(StatefulValue(StatefulValue::StringType(100, 'x', alloc)));
+    ASSERT_TRUE(copy["added"].GetAllocator() == alloc);
+  }
+  ASSERT_EQ(allocations, 0);
+  ASSERT_EQ(default_allocations, 0);
+  static_assert(sizeof(csonpp::ArenaAllocator<char>) == sizeof(csonpp::Arena*), 
+                "a stateless allocator takes no room");
+
+  // a writer is a handler copying a document without its whitespaces
+  std::string minified;
+  csonpp::Writer writer(minified);
+  ASSERT_TRUE(csonpp::Parser::Parse(" [ {\"a\" : 1 , \"b\":[ ]}, \"\\n\", 2.5 ] ", writer));
+  ASSERT_EQ(minified, "[{\"a\":1,\"b\":[]},\"\\n\",2.5]");
+}
+
+TEST(CsonppTest, ObjectOrder) {
+  std::string str = "{\"z\":1,\"a\":{\"y\":[true,null],\"b\":\"s\"},\"m\":-2.5}";
+  csonpp::Value value = csonpp::Parser::Deserialize(str);
+  ASSERT_EQ(csonpp::Parser::Serialize(value), str);
+  csonpp::Document document;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, document));
+  ASSERT_EQ(csonpp::Parser::Serialize(document.GetRoot()), str);
+
+  const csonpp::Object& object = value.GetObject();
+  auto itr = object.Begin();
+  ASSERT_EQ(itr->first, "z");
+  ASSERT_EQ((++itr)->first, "a");
+  ASSERT_EQ((++itr)->first, "m");
+  ASSERT_TRUE(object.Find("a") != object.End());
+  ASSERT_TRUE(object.Find("b") == object.End());
+
+  // the values can be changed through an iterator, the keys are const
+  csonpp::Object members = object;
+  for (auto itr = members.Begin(); itr != members.End(); ++itr)
+    itr->second = csonpp::Value(std::string(itr->first.data(), itr->first.size()));
+  static_assert(std::is_const<std::remove_reference<
+      decltype(members.Begin()->first)>::type>::value, "the key is const");
+  csonpp::Object::ConstIterator const_itr = members.Find("m");
+  ASSERT_EQ(const_itr->second.GetString(), "m");
+  ASSERT_EQ((*--members.End()).second.GetString(), "m");
+
+  // a key set again keeps its place
+  value["z"] = 3;
+  value["n"] = 4;
+  ASSERT_EQ(csonpp::Parser::Serialize(value), 
+            "{\"z\":3,\"a\":{\"y\":[true,null],\"b\":\"s\"},\"m\":-2.5,\"n\":4}");
+
+  // the order does not matter to the comparisons
+  csonpp::Value left = csonpp::Parser::Deserialize("{\"a\":1,\"b\":[2]}");
+  csonpp::Value right = csonpp::Parser::Deserialize("{\"b\":[2],\"a\":1}");
+  ASSERT_TRUE(left == right);
+  ASSERT_FALSE(left < right);
+  right["a"] = 2;
+  ASSERT_TRUE(left != right);
+  ASSERT_TRUE(left.GetObject() < right.GetObject());
+}
+
+TEST(CsonppTest, LargeObject) {
+  const int count = 5000;
+  std::string str = "{";
+  for (int i = 0; i < count; ++i) {
+    if (i)
+      str += ",";
+    str += "\"key" + std::to_string(count - i) + "\":" + std::to_string(i);
+  }
+  str += "}";
+  csonpp::Value value = csonpp::Parser::Deserialize(str);
+  ASSERT_EQ(value.GetObject().Size(), count);
+  ASSERT_EQ(csonpp::Parser::Serialize(value), str);
+  csonpp::Document document;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, document));
+  ASSERT_TRUE(document.GetRoot() == value);
+
+  // every key is found past the size the keys are hashed at
+  const csonpp::Object& object = value.GetObject();
+  for (int i = 0; i < count; ++i) {
+    auto itr = object.Find("key" + std::to_string(count - i));
+    ASSERT_TRUE(itr != object.End());
+    ASSERT_EQ(itr->second.GetInteger(), i);
+  }
+  ASSERT_TRUE(object.Find("key0") == object.End());
+  ASSERT_TRUE(object.Find("") == object.End());
+
+  // a key set again keeps its place, a new key goes last
+  value["key1"] = -1;
+  value["key0"] = -2;
+  ASSERT_EQ(value.GetObject().Size(), count + 1);
+  ASSERT_EQ((--value.GetObject().End())->first, "key0");
+  ASSERT_EQ(value["key1"].GetInteger(), -1);
+
+  // a copy keeps its own keys
+  csonpp::Value copy = value;
+  copy["copy"] = true;
+  ASSERT_TRUE(value.GetObject().Find("copy") == value.GetObject().End());
+  ASSERT_TRUE(copy.GetObject().Find("copy") != copy.GetObject().End());
+  ASSERT_EQ(copy["key2"].GetInteger(), count - 2);
+
+  // duplicate keys keep the last value
+  csonpp::Value duplicates = csonpp::Parser::Deserialize(
+      str.substr(0, str.size() - 1) + ",\"key3\":\"last\"}");
+  ASSERT_EQ(duplicates.GetObject().Size(), count);
+  ASSERT_EQ(duplicates["key3"].GetString(), "last");
+
+  // a cleared object goes back to a small one
+  csonpp::Object members;
+  for (int i = 0; i < count; ++i)
+    members[std::to_string(i)] = i;
+  ASSERT_EQ(members["4999"].GetInteger(), 4999);
+  members.Clear();
+  members["a"] = 1;
+  ASSERT_EQ(members.Size(), 1);
+  ASSERT_TRUE(members.Find("4999") == members.End());
+  ASSERT_TRUE(members.Find("a") != members.End());
+}
+
+TEST(CsonppTest, CollidingKeys) {
+  // keys hashed to the same slot of any table up to 4096 slots, found
+  // with the seed of this process, short ones and ones on the heap
+  const size_t count = 2000;
+  std::vector<std::string> keys;
+  uint64_t slot = csonpp::Object::Hash("0", 1) & 4095;
+  for (int i = 0; keys.size() < count; ++i) {
+    std::string key = (i % 2 ? "" : std::string(24, 'p')) + std::to_string(i);
+    if ((csonpp::Object::Hash(key.data(), key.size()) & 4095) == slot)
+      keys.push_back(key);
+  }
+  std::string str = "{";
+  for (size_t i = 0; i < count; ++i) {
+    if (i)
+      str += ",";
+    str += "\"" + keys[i] + "\":" + std::to_string(i);
+  }
+  str += "}";
+
+  // probing stops at kMaxProbes, the keys go in a tree instead
+  csonpp::Value value = csonpp::Parser::Deserialize(str);
+  ASSERT_EQ(value.GetObject().Size(), count);
+  ASSERT_EQ(csonpp::Parser::Serialize(value), str);
+  const csonpp::Object& object = value.GetObject();
+  for (size_t i = 0; i < count; ++i) {
+    auto itr = object.Find(keys[i]);
+    ASSERT_TRUE(itr != object.End());
+    ASSERT_EQ(itr->second.GetInteger(), i);
+  }
+  ASSERT_TRUE(object.Find("0") == object.End());
+  ASSERT_TRUE(object.Find(keys[0] + "0") == object.End());
+  csonpp::Document document;
+  ASSERT_TRUE(csonpp::Parser::Deserialize(str, document));
+  ASSERT_TRUE(document.GetRoot() == value);
+
+  // the tree follows the keys when they are added, copied and moved
+  csonpp::Object members;
+  for (size_t i = 0; i < count; ++i)
+    members[keys[i]] = static_cast<int64_t>(i);
+  members[keys[7]] = -1;
+  ASSERT_EQ(members.Size(), count);
+  csonpp::Object copy = members;
+  csonpp::Object moved(std::move(members));
+  members = std::move(copy);
+  members["0"] = true;
+  for (size_t i = 0; i < count; ++i) {
+    ASSERT_EQ(members[keys[i]], moved[keys[i]]);
+    ASSERT_EQ(moved[keys[i]].GetInteger(), i == 7 ? -1 : static_cast<int64_t>(i));
+  }
+  ASSERT_EQ(members.Size(), count + 1);
+  ASSERT_EQ(moved.Size(), count);
+  moved.Clear();
+  moved["a"] = 1;
+  ASSERT_TRUE(moved.Find(keys[0]) == moved.End());
+  ASSERT_TRUE(moved.Find("a") != moved.End());
+}